@@ -9,6 +9,15 @@
 #include <net/xfrm.h>
 #include <net/icmp.h>
 #include <net/sock.h>
+#include <net/netns/generic.h>
+#include <linux/kmod.h>
+#include <linux/jhash.h>
+#include <linux/cryptohash.h>
+#include <linux/hash.h>
+#include <linux/sysctl.h>
+#include <linux/scatterlist.h>
+#include <crypto/aead.h>
+#include <asm/unaligned.h>
 #include <trace/events/skb.h>
 //same kind of table as in UDP is kept
 struct udp_table 	quic_table __read_mostly;
@@ -32,90 +41,91 @@ static const struct net_protocol quic_protocol = {
 	.netns_ok	= 1, //default value: protocol is aware of network namespaces (if this field equals 0, nothing will work)
 };
 
-//Recalculating threshold after a loss event
-static u32 bictcp_recalc_ssthresh(struct sock *sk)
-{
-	struct quic_sock *qp = quic_sk(sk); /* see quic.h - finally found it */
-	struct quic_bictcp *ca = &qp->ca; /* see thesis for complete definition (...) */
-
-	ca->epoch_start = 0;	/* end of epoch, beginning of new one */
+//what the connections to a destination learned about the path, and the token its server issued us
+struct quic_metrics {
+	__be32			daddr;		//0 if the slot is free
+	unsigned long		stamp;		//jiffies of the last update of the path metrics
+	u32			srtt;		//us << 3, 0 if none
+	u32			rttvar;		//us
+	u32			ssthresh;	//bytes, 0 if none
+	u32			rate;		//largest delivery rate (bytes per second), 0 if none
+	__be16			token_port;	//server port the token is for, 0 if none
+	u32			token;
+};
 
-//special case considered: fast convergence
-	/* Wmax and fast convergence */
-	if (qp->cwnd < ca->last_max_cwnd && qp->fast_convergence)
-		ca->last_max_cwnd = (qp->cwnd * (BICTCP_BETA_SCALE + qp->beta))
-			/ (2 * BICTCP_BETA_SCALE);
-	else
-		ca->last_max_cwnd = qp->cwnd;
-//save previous congestion window
-	ca->loss_cwnd = qp->cwnd;
-//1024 as scale factor for beta calculation
-	return max((qp->cwnd * qp->beta) / BICTCP_BETA_SCALE, 2U); //2 as smallest threshold
-}
+//SYNs a CPU got in the current second
+struct quic_syn_rate {
+	unsigned long		stamp;		//start (jiffies) of the second
+	unsigned int		count;
+};
 
+//per network namespace state: default congestion control, the bounds of the reordering estimator and the metrics cache
+struct quic_net {
+	char			ca_default[QUIC_CA_NAME_MAX];
+	int			sysctl_reordering;
+	int			sysctl_max_reordering;
+	int			sysctl_reo_wnd;
+	int			sysctl_ecn;
+	int			sysctl_loss_diff;
+	int			sysctl_zero_rtt;
+	int			sysctl_init_cwnd;
+	int			sysctl_syn_cookies;
+	struct quic_syn_rate __percpu	*syn_rate;
+	spinlock_t		metrics_lock;
+	struct quic_metrics	metrics[QUIC_METRICS_CACHE_SIZE];
+	struct ctl_table_header	*sysctl_hdr;
+};
 
+static int quic_net_id __read_mostly;
 
 // ****   Timer functions
 // *****************************************************************************************
-//stop early retransmit timer and clear it
-static inline void quic_clear_early_retrans_timer
-			(struct sock *sk
-			// , int what
-			 ){
-	struct quic_sock *qp = quic_sk(sk);
-
-	sk_stop_timer(sk, &qp->quic_early_retrans_timer);	
-	qp->early_retransmit_time = 0;
-
-	printk("Cleared the early retransmit timer\n");
-}
-//reset early retransmit timer
-static inline void quic_reset_early_retrans_timer
-			(struct sock *sk,
-		//	 int what,
-			 unsigned long when){
-	struct quic_sock *qp = quic_sk(sk);
-//jiffies:= number of system clocks since it has booted!
-	qp->early_retransmit_time = jiffies + when;
-	sk_reset_timer(sk, &qp->quic_early_retrans_timer, qp->early_retransmit_time);
-	printk("Set the early retransmit timer\n");
+/*  All timer events of a connection (loss detection and delayed ACK) share one hrtimer. Each
+    event only keeps its own deadline (in us, 0 = not pending) and the hrtimer is armed for the
+    earliest of them. Re-arming is lazy: the hrtimer is only moved if the new deadline is earlier
+    than the one it is armed for; a later deadline is picked up when the timer fires */
+
+static inline u64 quic_timer_min(u64 next, u64 deadline){
+	if(!deadline)
+		return next;
+	if(!next || deadline < next)
+		return deadline;
+	return next;
 }
 
-//handler for early retransmit timer (what if this timer expires?)
-/* this timer is set if a packet is NACKed and the receiver has already received the largest
-sent packet. It's meant to prevent a RTO from the loss of just one packet */
-void quic_early_retrans_timer_handler(struct sock *sk){
+//arm the connection timer for the earliest pending deadline, if that is earlier than the present one
+static void quic_timer_arm(struct sock *sk){
 	struct quic_sock *qp = quic_sk(sk);
-
-	//If the timeout has not yet happened
-	if (time_after(qp->early_retransmit_time, jiffies)) {
-		sk_reset_timer(sk, &qp->quic_early_retrans_timer, qp->early_retransmit_time);
-		goto out;
-	}
-
-	//Do stuff
-	qp->nacked_in_q = 0;
-	retransmit_nacked(sk, 0);		
-	//retransmit not acknowledged packets immediately -> early retransmit!
-out:	
-	sk_mem_reclaim(sk);
+	u64 next = 0;
+
+	next = quic_timer_min(next, qp->loss_detection_time);
+	next = quic_timer_min(next, qp->del_ack_time);
+
+	if(!next)
+		return;		//nothing pending, an already armed timer just finds nothing to do
+	if(qp->timer_expires && qp->timer_expires <= next)
+		return;		//armed early enough
+
+	/*  Runs in process context as well as in softirq, with no common lock: the reference is
+	    taken atomically by whoever arms the timer from idle, and dropped by whoever idles it
+	    (quic_timer(), quic_stop_xmit_timers()) */
+	qp->timer_expires = next;
+	if(!test_and_set_bit(QUIC_TIMER_ARMED, &qp->timer_flags))
+		sock_hold(sk);
+	tasklet_hrtimer_start(&qp->quic_timer, ns_to_ktime(next * NSEC_PER_USEC),
+			      HRTIMER_MODE_ABS);
 }
 
+//convert a timeout in us to an absolute deadline of the connection timer
+static inline u64 quic_timer_deadline(u32 when){
+	return quic_clock_us() + when;
+}
 
-static void quic_early_retrans_timer(unsigned long data)
-{
-	struct sock *sk = (struct sock *)data;
+//convert a 32 bit packet timestamp (us) back to the 64 bit clock of the connection timer
+static inline u64 quic_stamp_to_clock(u32 stamp){
+	u64 now = quic_clock_us();
 
-	bh_lock_sock(sk);
-	if (!sock_owned_by_user(sk)) {
-		quic_early_retrans_timer_handler(sk);
-	} else {
-		printk("/* delegate our work to quic_release_cb() */\n");
-		if (!test_and_set_bit(QUIC_EARLY_RETRANS_TIMER_DEFERRED, &quic_sk(sk)->timer_flags))
-			sock_hold(sk);
-	}
-	bh_unlock_sock(sk);
-	sock_put(sk);
+	return now - (u32)((u32)now - stamp);
 }
 
 
@@ -129,7 +139,6 @@ static inline void quic_clear_del_ack_timer
 			 ){
 	struct quic_sock *qp = quic_sk(sk);
 
-	sk_stop_timer(sk, &qp->quic_del_ack_timer);	
 	qp->del_ack_time = 0;
 
 	printk("Cleared the DEL_ACK timer\n");
@@ -138,319 +147,761 @@ static inline void quic_clear_del_ack_timer
 static inline void quic_reset_del_ack_timer
 			(struct sock *sk,
 		//	 int what,
-			 unsigned long when){
+			 u32 when){
 	struct quic_sock *qp = quic_sk(sk);
 
-	qp->del_ack_time = jiffies + when;
-	sk_reset_timer(sk, &qp->quic_del_ack_timer, qp->del_ack_time);
+	qp->del_ack_time = quic_timer_deadline(when);
+	quic_timer_arm(sk);
 }
 
 //if this times our, then send the acknowledgment
 void quic_del_ack_timer_handler(struct sock *sk){
+	send_ack(sk);
+}
+
+
+// ****   Loss detection (RFC 9002)
+// *****************************************************************************************
+/*  A packet in flight is declared lost once a packet sent after it has been ACKed and either
+    qp->reordering later transmissions have been ACKed (packet threshold) or it was sent more
+    than 9/8 RTT, or RTT plus the reordering window, ago (time threshold). Transmission order is
+    given by the sequence number, which grows with every (re)transmission, and not by the offset,
+    which a retransmission keeps.
+    If nothing waits for the time threshold, the loss detection timer is a probe timeout (PTO)
+    with exponential backoff; it replaces the former TLP/RTO, early retransmit and loss timers */
+
+//time threshold: max(latest RTT, SRTT) + max(1/8 of it, reordering window), at least the timer granularity
+static inline u32 quic_loss_delay(const struct quic_sock *qp){
+	u32 rtt = max_t(u32, qp->latest_rtt, qp->srtt >> 3);
+
+	return max_t(u32, rtt + max(rtt >> 3, qp->reo_wnd), QUIC_GRANULARITY);
+}
+
+/*  Reordering estimator. A packet which is ACKed after it was reported missing or declared lost
+    was reordered: the packet threshold is raised above the number of later packets ACKed before
+    it, and the reordering window of the time threshold to how much later than SRTT it arrived.
+    Both stay within the bounds of the namespace (net.quic.max_reordering, and
+    net.quic.reordering_window in % of SRTT) and are reset to the defaults after
+    QUIC_REO_PERSIST recovery periods without any reordering */
+//initial packet threshold, net.quic.reordering within net.quic.max_reordering
+static inline u32 quic_reordering_init(const struct quic_net *qn){
+	return min(qn->sysctl_reordering, qn->sysctl_max_reordering);
+}
+
+static void quic_reorder_update(struct sock *sk, u32 distance, u32 delay){
+	struct quic_net *qn = net_generic(sock_net(sk), quic_net_id);
 	struct quic_sock *qp = quic_sk(sk);
+	u32 max_wnd = div_u64((u64)(qp->srtt >> 3) * qn->sysctl_reo_wnd, 100);
 
-	//If the timeout has not yet happened
-	if (time_after(qp->del_ack_time, jiffies)) {
-		sk_reset_timer(sk, &qp->quic_del_ack_timer, qp->del_ack_time);
-		goto out;
+	if(distance >= qp->reordering)
+		qp->reordering = min_t(u32, distance + 1, qn->sysctl_max_reordering);
+	if(delay > qp->reo_wnd)
+		qp->reo_wnd = min(delay, max_wnd);
+	qp->reo_persist = QUIC_REO_PERSIST;
+}
+
+static void quic_reorder_decay(struct sock *sk){
+	struct quic_net *qn = net_generic(sock_net(sk), quic_net_id);
+	struct quic_sock *qp = quic_sk(sk);
+
+	if(!qp->reo_persist || --qp->reo_persist)
+		return;
+	qp->reordering = quic_reordering_init(qn);
+	qp->reo_wnd = 0;
+	printk("No reordering seen for a while, packet threshold back to %u\n", qp->reordering);
+}
+
+//a reordered packet ACKed: record how far and how late it came in the sample
+static void quic_reorder_sample(const struct quic_sock *qp, struct sk_buff *skb, u32 now,
+				struct quic_ack_sample *rs){
+	struct quic_skb_cb *qb = QUIC_SKB_CB(skb);
+	s32 late = (s32)(now - qb->timestamp) - (s32)(qp->srtt >> 3);
+
+	rs->reordered = 1;
+	if(after(qp->highest_ack_sequence, qb->sequence))
+		rs->reorder = max(rs->reorder, qp->highest_ack_sequence - qb->sequence);
+	if(late > 0)
+		rs->reorder_time = max_t(u32, rs->reorder_time, late);
+}
+
+//probe timeout: srtt + max(4*rttvar, granularity) + max_ack_delay (mdev is kept as 4*rttvar)
+static inline u32 quic_pto(const struct quic_sock *qp){
+	if(qp->first_rtt)		//no RTT sample yet
+		return 2 * (qp->srtt >> 3);
+	return (qp->srtt >> 3) + max_t(u32, qp->mdev, QUIC_GRANULARITY) + qp->peer_tp.max_ack_delay;
+}
+
+//stop the loss detection timer and clear it
+static inline void quic_clear_loss_detection_timer(struct sock *sk){
+	struct quic_sock *qp = quic_sk(sk);
+
+	qp->loss_detection_time = 0;
+	qp->loss_time = 0;
+	qp->pto_count = 0;
+}
+
+//arm the loss detection timer: time threshold if a packet waits for it, else PTO from the last send
+void quic_set_loss_detection_timer(struct sock *sk){
+	struct quic_sock *qp = quic_sk(sk);
+	u64 timeout;
+
+	if(qp->loss_time){
+		qp->loss_detection_time = qp->loss_time;
+		quic_timer_arm(sk);
+		return;
+	}
+	if(!qp->packets_out){
+		qp->loss_detection_time = 0;	//nothing in flight which could get lost
+		return;
 	}
 
-	send_ack(sk);
-out:	
-	sk_mem_reclaim(sk);
+	timeout = (u64)quic_pto(qp) << min_t(unsigned int, qp->pto_count, QUIC_PTO_MAX_BACKOFF);
+	if(timeout > QUIC_RTO_MAX)
+		timeout = QUIC_RTO_MAX;
+	qp->loss_detection_time = quic_stamp_to_clock(qp->last_sent_time) + timeout;
+	quic_timer_arm(sk);
 }
 
+// ****   Multipath
+// *****************************************************************************************
+/*  A connection can send over several paths at once, e.g. over two interfaces. Packet numbers
+    and ACKs are the connection's, so an ACK covers the packets of every path and the receiver
+    needs no state per path. Path 0 is the connection's own route, with the full loss recovery and
+    the pluggable congestion control; the other paths have a route, a NewReno congestion window
+    in bytes and an RTT of their own. For each packet the scheduler picks a path with room in its
+    window, and loss detection of a packet only compares it with the packets of its own path, as
+    the paths reorder each other. Packets sent on another path have the mpath bit set, so the
+    peer validates their source address as an additional path instead of migrating there.
+    Lost packets go out again on whatever path the scheduler picks, and a path which only loses
+    packets is given up, its packets in flight are lost then */
+
+static inline struct quic_path *quic_mpath(struct quic_sock *qp, u8 id){
+	return &qp->mpath[id - 1];
+}
 
-static void quic_del_ack_timer(unsigned long data)
-{
-	struct sock *sk = (struct sock *)data;
+//bytes in flight of the path the packet was sent on
+static inline u32 *quic_in_flight(struct quic_sock *qp, const struct quic_skb_cb *qb){
+	return qb->path ? &quic_mpath(qp, qb->path)->bytes_in_flight : &qp->bytes_in_flight;
+}
 
-	bh_lock_sock(sk);
-	if (!sock_owned_by_user(sk)) {
-		quic_del_ack_timer_handler(sk);
-	} else {
-		printk("/* delegate our work to quic_release_cb() */\n");
-		if (!test_and_set_bit(QUIC_DEL_ACK_TIMER_DEFERRED, &quic_sk(sk)->timer_flags))
-			sock_hold(sk);
+//path for the next packet, -1 if every congestion window is full
+static int quic_mpath_select(struct sock *sk){
+	struct quic_sock *qp = quic_sk(sk);
+	struct quic_path *p;
+	u64 val, best_val = 0;
+	int i, best = -1;
+
+	if(qp->bytes_in_flight < qp->cwnd){
+		best = 0;
+		if(!qp->mpath_cnt)
+			return 0;
+		best_val = qp->mpath_sched == QUIC_SCHED_RATE ?
+			div_u64((u64)(qp->bytes_in_flight + QUIC_MSS) * qp->srtt, qp->cwnd) : qp->srtt;
 	}
-	bh_unlock_sock(sk);
-	sock_put(sk);
+	for(i = 1; i < QUIC_MAX_PATHS && qp->mpath_cnt; i++){
+		p = quic_mpath(qp, i);
+		if(!p->rt || p->bytes_in_flight >= p->cwnd)
+			continue;
+		//time to send the window share of the path, or its RTT
+		val = qp->mpath_sched == QUIC_SCHED_RATE ?
+			div_u64((u64)(p->bytes_in_flight + QUIC_MSS) * p->srtt, p->cwnd) : p->srtt;
+		if(best < 0 || val < best_val){
+			best = i;
+			best_val = val;
+		}
+	}
+	return best;
 }
-/* Retransmission TimeOut and Tail Loss Probe timers. TLP set with a value depending on the 
-number of transmitted but unACKed packets */
 
-//stop RTO/TLP timer and clear it
-static inline void quic_clear_rto_tlp_timer
-			(struct sock *sk
-			// , int what
-			 ){
+static inline bool quic_mpath_can_send(struct sock *sk){
 	struct quic_sock *qp = quic_sk(sk);
+	u32 in_flight = qp->bytes_in_flight;
+	int i;
+
+	if(!qp->mpath_cnt)
+		return in_flight < min(qp->cwnd, qp->peer_tp.rcv_wnd);
+	//the receive window of the peer is shared by the paths
+	for(i = 1; i < QUIC_MAX_PATHS; i++)
+		in_flight += quic_mpath(qp, i)->bytes_in_flight;
+	return in_flight < qp->peer_tp.rcv_wnd && quic_mpath_select(sk) >= 0;
+}
 
-	sk_stop_timer(sk, &qp->quic_rto_tlp_timer);	
-	qp->retransmits = 0;    //clear number of retransmits
-	qp->tlp_out = 0;        //number of times the TLP timer has expired
-	qp->tlp_rto_time = 0;
+//RTT sample of a path (us)
+static void quic_mpath_rtt(struct quic_path *p, u32 rtt){
+	s32 m = rtt - (p->srtt >> 3);
 
-	printk("Cleared the RTO/TLP timer\n");
+	p->srtt += m;		//srtt = 7/8 srtt + 1/8 new
+	if(!p->srtt)
+		p->srtt = 1;
 }
 
-//reset RTO/TLP timer
-static inline void quic_reset_rto_tlp_timer
-			(struct sock *sk,
-		//	 int what,
-			 unsigned long when){
+//stop using a path: its packets in flight are lost, to be sent again on the other paths
+static void quic_mpath_fail(struct sock *sk, u8 id){
+	struct quic_sock *qp = quic_sk(sk);
+	struct quic_path *p = quic_mpath(qp, id);
+	struct quic_skb_cb *qb;
+	struct sk_buff *skb;
+
+	printk("Giving up path %u from %pI4 to %pI4\n", id, &p->saddr, &p->daddr);
+	ip_rt_put(p->rt);
+	p->rt = NULL;
+	qp->mpath_cnt--;
+	if(IS_ERR_OR_NULL(qp->last_sent))
+		return;
+	skb_queue_walk(&sk->sk_write_queue, skb) {
+		qb = QUIC_SKB_CB(skb);
+		if(qb->path == id && !(qb->flags & QUIC_PKT_LOST)){
+			qb->flags |= QUIC_PKT_LOST;
+			qp->lost_out++;
+			if(qp->packets_out)
+				qp->packets_out--;
+			p->bytes_in_flight -= min(skb->len, p->bytes_in_flight);
+		}
+		if(skb == qp->last_sent)
+			break;
+	}
+}
+
+//loss check of a packet sent on another path than 0, see quic_check_lost()
+static int quic_mpath_check_lost(struct sock *sk, struct sk_buff *skb, u32 now){
 	struct quic_sock *qp = quic_sk(sk);
+	struct quic_skb_cb *qb = QUIC_SKB_CB(skb);
+	struct quic_path *p = quic_mpath(qp, qb->path);
+	u32 srtt = p->srtt >> 3;
 
-	qp->tlp_rto_time = jiffies + when;
+	if(!after(p->acked_seq, qb->sequence))
+		return 0;
+	if(p->acked_seq - qb->sequence < qp->reordering &&
+	   (s32)(now - qb->timestamp) < (s32)(srtt + (srtt >> 3)))
+		return 0;
+
+	qb->flags |= QUIC_PKT_LOST;
+	qp->lost_out++;
+	if(qp->packets_out)
+		qp->packets_out--;
+	p->bytes_in_flight -= min(skb->len, p->bytes_in_flight);
+	printk("Declared packet with offset %u, sequence %u lost on path %u\n", qb->offset, qb->sequence, qb->path);
+
+	//one window reduction per round trip
+	if(p->rt && after(qb->timestamp, p->recovery_start)){
+		p->ssthresh = max_t(u32, p->cwnd >> 1, QUIC_MIN_CWND);
+		p->cwnd = p->ssthresh;
+		p->cwnd_cnt = 0;
+		p->recovery_start = now;
+		if(++p->loss_rounds >= QUIC_MPATH_LOSS_ROUNDS)
+			quic_mpath_fail(sk, qb->path);
+	}
+	return 1;
+}
+
+//a packet sent on another path than 0 has been ACKed
+static void quic_mpath_acked(struct sock *sk, struct sk_buff *skb){
+	struct quic_sock *qp = quic_sk(sk);
+	struct quic_skb_cb *qb = QUIC_SKB_CB(skb);
+	struct quic_path *p = quic_mpath(qp, qb->path);
+
+	if(after(qb->sequence, p->acked_seq))
+		p->acked_seq = qb->sequence;
+	p->loss_rounds = 0;
+	if(qb->flags & QUIC_PKT_LOST){
+		qp->lost_out--;		//arrived after all
+		return;
+	}
+	if(qp->packets_out)
+		qp->packets_out--;
+	p->bytes_in_flight -= min(skb->len, p->bytes_in_flight);
 
-	sk_reset_timer(sk, &qp->quic_rto_tlp_timer, qp->tlp_rto_time);
-//like in thesis: TLP becomes RTO if expired twice or more!
-	if(qp->tlp_out < 2){
-		printk("Set the TLP timer to %lums for TLP number %u\n", when, qp->tlp_out);
+	if(p->cwnd < p->ssthresh){
+		p->cwnd += skb->len;	//slow start
 	}else{
-		printk("Set the RTO timer to %lums\n", when);
+		p->cwnd_cnt += skb->len;
+		if(p->cwnd_cnt >= p->cwnd){
+			p->cwnd_cnt -= p->cwnd;
+			p->cwnd += QUIC_MSS;
+		}
+	}
+}
+
+//route a path from saddr to the peer address daddr:dport; saddr 0 lets the route pick it
+static int quic_mpath_route(struct sock *sk, struct quic_path *p, __be32 saddr){
+	struct flowi4 fl4;
+	struct rtable *rt;
+
+	rt = ip_route_output_ports(sock_net(sk), &fl4, sk, p->daddr, saddr, p->dport,
+				   inet_sk(sk)->inet_sport, IPPROTO_QUIC, RT_CONN_FLAGS(sk),
+				   sk->sk_bound_dev_if);
+	if(IS_ERR(rt))
+		return PTR_ERR(rt);
+	if(p->rt)
+		ip_rt_put(p->rt);
+	p->rt = rt;
+	p->saddr = fl4.saddr;
+	return 0;
+}
+
+//path from the local address saddr to the peer address daddr:dport, if in use
+static struct quic_path *quic_mpath_find(struct quic_sock *qp, __be32 saddr, __be32 daddr, __be16 dport){
+	struct quic_path *p;
+	int i;
+
+	for(i = 1; i < QUIC_MAX_PATHS; i++){
+		p = quic_mpath(qp, i);
+		if(p->rt && p->saddr == saddr && p->daddr == daddr && p->dport == dport)
+			return p;
 	}
+	return NULL;
 }
 
-//when the TLP timer expires, a single packet is resent as probe and the timer is reset as a TLP or RTO timer
-void quic_rto_tlp_timer_handler(struct sock *sk){
+//start sending over another path, from saddr (0: any) to the peer address daddr:dport
+static int quic_mpath_add(struct sock *sk, __be32 saddr, __be32 daddr, __be16 dport){
+	struct quic_sock *qp = quic_sk(sk);
+	struct inet_sock *inet = inet_sk(sk);
+	struct quic_net *qn = net_generic(sock_net(sk), quic_net_id);
+	struct quic_path *p = NULL;
+	int i, err;
+
+	if(sk->sk_state != TCP_ESTABLISHED)
+		return -ENOTCONN;
+	if(!(qp->local_tp.features & qp->peer_tp.features & QUIC_TP_MPATH))
+		return -EOPNOTSUPP;
+	if(!rcu_access_pointer(qp->aead_tx))	//the peer would not validate the new address
+		return -EPERM;
+	if((saddr == inet->inet_saddr && daddr == inet->inet_daddr && dport == inet->inet_dport) ||
+	   (saddr && quic_mpath_find(qp, saddr, daddr, dport)))
+		return -EEXIST;
+	//a path is free once its last packets are not in flight anymore
+	for(i = 1; i < QUIC_MAX_PATHS; i++){
+		if(!quic_mpath(qp, i)->rt && !quic_mpath(qp, i)->bytes_in_flight){
+			p = quic_mpath(qp, i);
+			break;
+		}
+	}
+	if(!p)
+		return -ENOBUFS;
+
+	p->daddr = daddr;
+	p->dport = dport;
+	err = quic_mpath_route(sk, p, saddr);
+	if(err)
+		return err;
+	if(p->saddr == inet->inet_saddr && daddr == inet->inet_daddr && dport == inet->inet_dport){
+		ip_rt_put(p->rt);
+		p->rt = NULL;
+		return -EEXIST;
+	}
+	p->cwnd = qn->sysctl_init_cwnd * QUIC_MSS;
+	p->ssthresh = UINT_MAX;
+	p->cwnd_cnt = 0;
+	p->srtt = qp->srtt;		//until the path has samples of its own
+	p->acked_seq = qp->send_next_sequence - 1;
+	p->recovery_start = QUIC_TIMESTAMP;
+	p->loss_rounds = 0;
+	qp->mpath_cnt++;
+	printk("Added path %u from %pI4 to %pI4:%u\n", i, &p->saddr, &p->daddr, ntohs(p->dport));
+	if(!qp->sending)
+		try_send_packets(sk);
+	return 0;
+}
+
+static void quic_mpath_release(struct sock *sk){
 	struct quic_sock *qp = quic_sk(sk);
-	struct sk_buff *skb;
-	u32 rto;
 	int i;
 
-	//If the timeout has not yet happened
-	if (time_after(qp->tlp_rto_time, jiffies)) {
-		sk_reset_timer(sk, &qp->quic_rto_tlp_timer, qp->tlp_rto_time);
-		goto out;
+	for(i = 1; i < QUIC_MAX_PATHS; i++){
+		if(quic_mpath(qp, i)->rt)
+			ip_rt_put(quic_mpath(qp, i)->rt);
+		memset(quic_mpath(qp, i), 0, sizeof(struct quic_path));
 	}
+	qp->mpath_cnt = 0;
+}
 
+/*  Loss check for one packet which has been sent and not ACKed. "now" and "loss_delay" are
+    computed once by the caller. Returns 1 if the packet is declared lost; otherwise the time at
+    which the time threshold would declare it lost is remembered in rs */
+static int quic_check_lost(struct sock *sk, struct sk_buff *skb, u32 now, u32 loss_delay,
+			   struct quic_ack_sample *rs){
+	struct quic_sock *qp = quic_sk(sk);
+	struct quic_skb_cb *qb = QUIC_SKB_CB(skb);
+	u32 deadline;
+	u32 largest = qp->mpath_cnt ? qp->mp_acked_seq : qp->highest_ack_sequence;
+
+	if(qb->flags & QUIC_PKT_LOST)
+		return 0;		//already waiting for retransmission
+	if(qb->path)
+		return quic_mpath_check_lost(sk, skb, now);
+
+	//only packets sent before the largest ACKed one (of the same path) can be lost
+	if(!after(largest, qb->sequence)){
+		rs->run_len = 0;
+		return 0;
+	}
 
-	//Do stuff
-	//tlp_out < 2 -> still TLP timer
-	if(qp->tlp_out < 2){
-		if(skb_queue_empty(&sk->sk_write_queue)){
-				printk("Error: TLP timer fired when send queue empty\n"); //there's an error: TLP timer shouldn't fire!
-				goto out;
-		}
-		//function for actual packet sending -> send a packet immediately as probe!
-		quic_finish_send_skb(skb_peek(&sk->sk_write_queue), 1, 1);
-		qp->tlp_out++;
-		printk("TLP timer expired at %lums, number of TLPs sent = %u\n", jiffies, qp->tlp_out);
-		//Set the timer again, using formulas 3.4 to 3.5
-		if(qp->tlp_out == 2){
-			quic_reset_rto_tlp_timer(sk, qp->rto);  //timer has expired twice now -> RTO
-		}else if(qp->tlp_out == 1){
-			if(qp->packets_out == 1){               //only one packet in flight
-				quic_reset_rto_tlp_timer(sk, max( 1.5*(qp->srtt>>3)+QUIC_DEL_ACK,  2*(qp->srtt>>3)));
-			}else if(qp->packets_out > 1){          //multiple packets in flight
-				quic_reset_rto_tlp_timer(sk, max( msecs_to_jiffies(10),  2*(qp->srtt>>3)));
-			}
-		}else{
-			printk("Error: Invalid qp->tlp_out value of %u\n", qp->tlp_out);
-		}
-        //already failed twice
-	} else if(qp->tlp_out == 2){
-		qp->retransmits++;
-		qp->number_rto_packets = 0;
-		printk("RTO Timer expired at %lums, retransmits = %u\n", jiffies, qp->retransmits);
-		if(qp->rto > (QUIC_RTO_MAX/2)){
-			rto = QUIC_RTO_MAX;
-		}else{
-			rto = qp->rto;
-			for(i = qp->retransmits; i>0; i--){
-				rto *= 2;
-				if(rto > QUIC_RTO_MAX)
-					break;
-			}
-			if(rto > QUIC_RTO_MAX)
-				rto = QUIC_RTO_MAX; //RFC6298
-		}
-		quic_reset_rto_tlp_timer(sk, rto);
-        
-		if(skb_queue_empty(&sk->sk_write_queue)){
-				printk("Error: RTO timer fired when send queue empty\n");
-				goto out;
-		}
-        //loss event -> reset congestion window and recalculate threshold
-		qp->ssthresh = bictcp_recalc_ssthresh(sk);
-		qp->cwnd = 1;
-		qp->ca_state = QUIC_CA_Loss;
-        //send next, or next two, packets (remember: every second packet gets ACKed if everything goes well)
-		skb = skb_peek(&sk->sk_write_queue);
-		quic_finish_send_skb(skb, 1, 1);
-		qp->number_rto_packets = 1;
-		if(skb_queue_len(&sk->sk_write_queue) > 1){
-			quic_finish_send_skb(skb->next, 1, 1);
-			qp->number_rto_packets = 2;
+	if(largest - qb->sequence >= qp->reordering ||
+	   (s32)(now - qb->timestamp) >= (s32)loss_delay){
+		qb->flags |= QUIC_PKT_LOST;
+		qp->lost_out++;
+		if(qp->packets_out)
+			qp->packets_out--;	//not in flight anymore
+		qp->bytes_in_flight -= min(skb->len, qp->bytes_in_flight);
+		if(!rs->lost || after(qb->timestamp, rs->lost_sent_time))
+			rs->lost_sent_time = qb->timestamp;
+		rs->lost++;
+		rs->lost_bytes += skb->len;
+
+		//persistent congestion: a run of lost packets spanning more than 3 PTOs
+		if(!rs->run_len){
+			rs->run_start = rs->run_end = qb->timestamp;
+		}else if(before(qb->timestamp, rs->run_start)){
+			rs->run_start = qb->timestamp;
+		}else if(after(qb->timestamp, rs->run_end)){
+			rs->run_end = qb->timestamp;
 		}
+		rs->run_len++;
+		if(!qp->first_rtt && rs->run_len > 1 &&
+		   rs->run_end - rs->run_start > QUIC_PERSISTENT_CONGESTION_THRESHOLD * quic_pto(qp))
+			rs->persistent = 1;
 
-	}else{
-		printk("Unforseen condition in quic_rto_tlp_timer_handler(), tlp_out = %u\n", qp->tlp_out);
+		printk("Declared packet with offset %u, sequence %u lost\n", qb->offset, qb->sequence);
+		return 1;
 	}
 
-out:	
-	sk_mem_reclaim(sk);
+	deadline = qb->timestamp + loss_delay;
+	if(!rs->loss_time_valid || before(deadline, rs->loss_time)){
+		rs->loss_time = deadline;
+		rs->loss_time_valid = 1;
+	}
+	rs->run_len = 0;
+	return 0;
 }
-/*  this function, as well as the similar ones for the other timers, checks whether the socket is already locked,
-    in which case it has to wait until it is released. After that, the "actual" handler function is called */
-static void quic_rto_tlp_timer(unsigned long data)
-{
-	struct sock *sk = (struct sock *)data;
 
-	bh_lock_sock(sk);
-	if (!sock_owned_by_user(sk)) {
-		quic_rto_tlp_timer_handler(sk);
-	} else {
-		printk("/* delegate our work to quic_release_cb() */\n");
-		if (!test_and_set_bit(QUIC_RTO_TLP_TIMER_DEFERRED, &quic_sk(sk)->timer_flags))
-			sock_hold(sk);
+//loss check of every packet in flight, used when the time threshold expires
+static void quic_detect_lost(struct sock *sk, struct quic_ack_sample *rs){
+	struct quic_sock *qp = quic_sk(sk);
+	struct sk_buff *skb;
+	u32 now = QUIC_TIMESTAMP;
+	u32 loss_delay = quic_loss_delay(qp);
+
+	memset(rs, 0, sizeof(*rs));
+	if(IS_ERR_OR_NULL(qp->last_sent))
+		return;
+
+	skb_queue_walk(&sk->sk_write_queue, skb) {
+		quic_check_lost(sk, skb, now, loss_delay, rs);
+		if(skb == qp->last_sent)
+			break;		//everything after it has never been sent
 	}
-	bh_unlock_sock(sk);
-	sock_put(sk);
 }
 
+/* Proportional Rate Reduction (RFC 6937). Instead of dropping to the reduced window at once and sending nothing
+ * until enough packets leave the network, the window is recomputed on every ACK during recovery so that
+ * retransmissions and new data go out in proportion to what is delivered, reaching the target at the end of recovery */
+static void quic_prr_update(struct sock *sk, unsigned int delivered){
+	struct quic_sock *qp = quic_sk(sk);
+	int delta = qp->prr_target - qp->bytes_in_flight;
+	int sndcnt;
 
+	if(!qp->prr_target)
+		return;
+	qp->prr_delivered += delivered;
+	if(delta < 0){
+		u64 dividend = (u64)qp->prr_target * qp->prr_delivered + qp->recover_fs - 1;
+		sndcnt = div_u64(dividend, qp->recover_fs) - qp->prr_out;
+	}else{
+//slow start reduction bound: no more than one packet above what was delivered
+		sndcnt = min_t(int, delta, max_t(int, qp->prr_delivered - qp->prr_out, delivered) + QUIC_MSS);
+	}
+//let the first retransmission out right away
+	sndcnt = max(sndcnt, qp->prr_out ? 0 : QUIC_MSS);
+	qp->cwnd = qp->bytes_in_flight + sndcnt;
+}
 
+static void quic_prr_init(struct sock *sk, unsigned int prior_cwnd, const struct quic_ack_sample *rs){
+	struct quic_sock *qp = quic_sk(sk);
 
-// Hshake and Loss Timer
-/* 1.   if SYN has been sent, retransmit the hello packet for the client if a reply hasn't been received
-        in a specified time
-   2.   if socket connected, implement fast retransmit - update congestion window and retransmit NACKed 
-        packets, if there's any */
+//nothing to pace if the algorithm did not shrink the window
+	if(qp->cwnd >= prior_cwnd){
+		qp->prr_target = 0;
+		return;
+	}
+	qp->prr_target = qp->cwnd;
+	qp->prr_delivered = 0;
+	qp->prr_out = 0;
+	qp->recover_fs = max(qp->bytes_in_flight + rs->lost_bytes, 1U);
+	quic_prr_update(sk, 0);
+}
 
-//stop handshake and loss timer and clear it
-static inline void quic_clear_hshake_loss_timer
-			(struct sock *sk
-			// , int what
-			 ){
+//leaving recovery: continue from the reduced window
+static void quic_prr_exit(struct sock *sk){
 	struct quic_sock *qp = quic_sk(sk);
 
-	sk_stop_timer(sk, &qp->quic_hshake_loss_timer);	
-	qp->retransmits = 0;        //here also - reset number of retransmission
-	qp->hshake_loss_time = 0;
+	if(!qp->prr_target)
+		return;
+	qp->cwnd = qp->prr_target;
+	qp->prr_target = 0;
+}
+
+/*  Undo of a recovery period all of whose losses were spurious (RFC 4015 style): the packets were
+    only delayed, e.g. by link layer retries, so the window and threshold from before the reduction
+    are restored and the packet threshold is raised above the reordering measured for them */
+static void quic_undo_recovery(struct sock *sk){
+	struct quic_sock *qp = quic_sk(sk);
 
-	printk("Cleared the hshake/loss timer\n");
+	if(qp->ca_ops->undo)
+		qp->cwnd = qp->ca_ops->undo(sk);
+	else
+		qp->cwnd = max(qp->cwnd, qp->prior_cwnd);
+	if(qp->prior_ssthresh > qp->ssthresh)
+		qp->ssthresh = qp->prior_ssthresh;
+	quic_reorder_update(sk, qp->undo_reorder, 0);	//the losses were reordering after all
+	qp->prr_target = 0;
+	qp->undo_marker = 0;
+	qp->ca_state = qp->nacked_in_q ? QUIC_CA_Disorder : QUIC_CA_Open;
+	printk("Spurious recovery undone, CWND = %u, SSThreshold = %u, reordering = %u\n",
+	       qp->cwnd, qp->ssthresh, qp->reordering);
 }
 
-//reset handshake and loss timer
-static inline void quic_reset_hshake_loss_timer
-			(struct sock *sk,
-		//	 int what,
-			 unsigned long when){
+//account the losses proven spurious by one ACK, undo the recovery period once none is left
+static void quic_check_undo(struct sock *sk, const struct quic_ack_sample *rs){
 	struct quic_sock *qp = quic_sk(sk);
 
-	qp->hshake_loss_time = jiffies + when;
+	if(!qp->undo_marker)
+		return;
+	if(rs->undo_fail){
+		qp->undo_marker = 0;	//some retransmission was needed
+		return;
+	}
+	if(!rs->spurious)
+		return;
+	qp->undo_reorder = max(qp->undo_reorder, rs->reorder);
+	qp->undo_retrans -= min(rs->spurious, qp->undo_retrans);
+	if(!qp->undo_retrans && qp->ca_state == QUIC_CA_Recovery)
+		quic_undo_recovery(sk);
+}
+
+//one reduction per recovery period: congestion signals for packets sent before it started belong to the same event
+static void quic_enter_recovery(struct sock *sk, const struct quic_ack_sample *rs, u32 sent_time){
+	struct quic_sock *qp = quic_sk(sk);
+	unsigned int prior_cwnd = qp->cwnd;
 
-	sk_reset_timer(sk, &qp->quic_hshake_loss_timer, qp->hshake_loss_time);
+	if(qp->ca_state == QUIC_CA_Recovery && !after(sent_time, qp->recovery_start))
+		return;
+	qp->prior_cwnd = qp->cwnd;
+	qp->prior_ssthresh = qp->ssthresh;
+	qp->undo_marker = 1;
+	qp->undo_retrans = 0;
+	qp->undo_reorder = 0;
+	qp->recovery_start = QUIC_TIMESTAMP;
+	quic_reorder_decay(sk);
+	qp->ca_ops->on_loss(sk, rs);
+	qp->ca_state = QUIC_CA_Recovery;
+	printk("Congestion detected, new CWND and SSThreshold = %u\n", qp->cwnd);
+	quic_prr_init(sk, prior_cwnd, rs);
 }
 
-//this function decides what to do based on the socket state - if connected or not
-void quic_hshake_loss_timer_handler(struct sock *sk){
+/*  Loss differentiation for wireless links. A loss is taken as random (channel errors) rather
+    than congestive only if every signal available agrees:
+    - RTT trend: the latest RTT is not above SRTT and holds little queueing delay over min RTT
+    - burstiness: a single packet was lost, a queue overflow tends to drop several
+    - arrival spacing: the ACKs of the rate sample came back about as spaced as the packets
+      were sent; a bottleneck queue spreads them out
+    - history: no other loss was taken as random in the last QUIC_RANDOM_LOSS_ROUNDS SRTTs,
+      a tail drop bottleneck that loses a packet every few rounds is congestion
+    Random losses still reduce cwnd, by 1/8 instead of the cut of the congestion control. Off
+    by default, switched on with the sysctl net.quic.loss_differentiation */
+static bool quic_loss_is_random(struct sock *sk, const struct quic_ack_sample *rs){
+	struct quic_net *qn = net_generic(sock_net(sk), quic_net_id);
 	struct quic_sock *qp = quic_sk(sk);
-	u32 rto;
-	int i;
 
-	//If the timeout has not yet happened, reset timer and quit (quite uninteresting...)
-	if (time_after(qp->hshake_loss_time, jiffies)) {
-		sk_reset_timer(sk, &qp->quic_hshake_loss_timer, qp->hshake_loss_time);
-		goto out;
+	if(!qn->sysctl_loss_diff || rs->persistent || qp->min_rtt == ~0U)
+		return 0;
+	if(qp->latest_rtt > (qp->srtt >> 3) ||
+	   qp->latest_rtt - qp->min_rtt > qp->min_rtt >> QUIC_RANDOM_LOSS_QDELAY_SHIFT)
+		return 0;
+	if(rs->lost > 1)
+		return 0;
+	if(qp->random_loss_time &&
+	   (s32)(QUIC_TIMESTAMP - qp->random_loss_time) < (s32)(QUIC_RANDOM_LOSS_ROUNDS * (qp->srtt >> 3)))
+		return 0;
+	if(rs->prior_valid && rs->send_elapsed &&
+	   rs->ack_elapsed * 4 > rs->send_elapsed * QUIC_RANDOM_LOSS_SPREAD)
+		return 0;
+	return 1;
+}
+
+/*  Reaction to the packets declared lost by one ACK or one timer expiry: the congestion window
+    is reduced once per recovery period (packets sent before the period started do not reduce it
+    again), and only persistent congestion collapses it to the minimum */
+static void quic_on_packets_lost(struct sock *sk, const struct quic_ack_sample *rs){
+	struct quic_sock *qp = quic_sk(sk);
+
+	qp->loss_time = rs->loss_time_valid ? quic_stamp_to_clock(rs->loss_time) : 0;
+	if(!rs->lost)
+		return;
+
+	if(quic_loss_is_random(sk, rs)){
+		qp->random_loss_time = QUIC_TIMESTAMP;
+		qp->cwnd = max_t(u32, qp->cwnd - (qp->cwnd >> QUIC_RANDOM_LOSS_CUT_SHIFT), QUIC_MIN_CWND);
+		qp->ssthresh = min(qp->ssthresh, qp->cwnd);
+		printk("Loss classified as random, CWND reduced to %u\n", qp->cwnd);
+		return;
 	}
 
-    //switch: check socket state
-	switch(sk->sk_state){
-	case TCP_SYN_SENT:          //connection is being established -> HANDSHAKE timer
-	
-		if(skb_queue_empty(&sk->sk_write_queue)){
-			printk("Error: Nothing to send on Handshake timer expiration\n");
-			goto out;
-		}
-    //retransmit the hello packet for the client
-		qp->retransmits++;
-		rto = 1.5*((qp->srtt)>>3);
-		for(i = qp->retransmits; i>0; i--){
-			rto *= 2;
-			if(rto > QUIC_RTO_MAX)
-				break;
-		}
-		if(rto > QUIC_RTO_MAX)
-			rto = QUIC_RTO_MAX;
+	quic_enter_recovery(sk, rs, rs->lost_sent_time);
+	qp->undo_retrans += rs->lost;
+	if(rs->persistent){
+		qp->prr_target = 0;
+		qp->cwnd = QUIC_MIN_CWND;
+		if(qp->ca_ops->on_rto)
+			qp->ca_ops->on_rto(sk);
+		printk("Persistent congestion, CWND collapsed to %u\n", qp->cwnd);
+	}
+}
+
+//PTO probe: new data if there is some not yet sent, otherwise the oldest packet in flight again
+static void quic_send_probe(struct sock *sk){
+	struct quic_sock *qp = quic_sk(sk);
+	struct sk_buff *skb;
 
-		quic_reset_hshake_loss_timer(sk, rto);
+	if(IS_ERR_OR_NULL(qp->last_sent)){
+		skb = skb_peek(&sk->sk_write_queue);
+	}else if(qp->last_sent != skb_peek_tail(&sk->sk_write_queue)){
+		skb = qp->last_sent->next;
+	}else{
+		skb = NULL;
+	}
+	if(skb){
+		if(!quic_finish_send_skb(skb, 1, 0))
+			qp->last_sent = skb;
+		return;
+	}
 
-		printk("QUIC handshake Timer expired, resetting it to %ums\n", rto);
+	skb_queue_walk(&sk->sk_write_queue, skb) {
+		if(!(QUIC_SKB_CB(skb)->flags & QUIC_PKT_LOST)){
+			QUIC_SKB_CB(skb)->flags |= QUIC_PKT_RETRANS;
+			quic_finish_send_skb(skb, 1, 1);
+			return;
+		}
+	}
+}
 
-		quic_finish_send_skb(skb_peek(&sk->sk_write_queue), 1, 1);
-	
-		//Need to implement Backoff
+//the loss detection timer fired: either the time threshold of a packet or a probe timeout
+void quic_loss_detection_timer_handler(struct sock *sk){
+	struct quic_sock *qp = quic_sk(sk);
+	struct quic_ack_sample rs;
 
-		goto out;
+	if(skb_queue_empty(&sk->sk_write_queue)){
+		printk("Error: Loss detection timer fired when send queue empty\n");
+		quic_clear_loss_detection_timer(sk);
+		return;
+	}
 
+	if(qp->loss_time){
+		quic_detect_lost(sk, &rs);
+		quic_on_packets_lost(sk, &rs);
+		try_send_packets(sk);		//lost packets go out first
+		quic_set_loss_detection_timer(sk);
+		return;
+	}
 
+	qp->pto_count++;
+	printk("PTO expired at %lluus, PTO count = %u\n", quic_clock_us(), qp->pto_count);
 
-	case TCP_ESTABLISHED:       //connection has already been established -> LOSS timer
-	      	//Follow the Retransmit strategy at
-	      	// https://tools.ietf.org/html/draft-tsvwg-quic-loss-recovery-01
-		
-		/*qp->packets_out = 0;
-		qp->last_sent = NULL;*/
+	if(sk->sk_state == TCP_SYN_SENT){
+		//retransmit the hello packet for the client
+		if(!quic_finish_send_skb(skb_peek(&sk->sk_write_queue), 1, 1))
+			qp->last_sent_time = QUIC_SKB_CB(skb_peek(&sk->sk_write_queue))->timestamp;
+	}else{
+		//two probes, so a single loss does not cost another PTO
+		quic_send_probe(sk);
+		quic_send_probe(sk);
+	}
+	quic_set_loss_detection_timer(sk);
+}
 
-	      	//Report loss to congestion controller
-		qp->cwnd = qp->ssthresh = bictcp_recalc_ssthresh(sk);
-		qp->ca_state = QUIC_CA_Recovery;
-	      
-		printk("QUIC Loss Timer expired at %lu, New CWND and SSThreshold = %u\n", jiffies, qp->cwnd);
-	      	//Retransmit as many as allowed
-		//try_send_packets(sk);
-		qp->nacked_in_q = 0;
-		retransmit_nacked(sk, RESEND_THRESHOLD);
+/*  Runs every timer event whose deadline has passed, then re-arms the connection timer for the
+    next pending one. Called with the socket bh-locked and not owned by the user */
+static void quic_timer_handler(struct sock *sk){
+	struct quic_sock *qp = quic_sk(sk);
+	u64 now = quic_clock_us();
 
-		//Retransmit => Retransmit the packets
+	if(qp->loss_detection_time && qp->loss_detection_time <= now){
+		qp->loss_detection_time = 0;
+		quic_loss_detection_timer_handler(sk);
+	}
+	if(qp->del_ack_time && qp->del_ack_time <= now){
+		qp->del_ack_time = 0;
+		quic_del_ack_timer_handler(sk);
 	}
 
-out:	
+	quic_timer_arm(sk);
 	sk_mem_reclaim(sk);
 }
 
-static void quic_hshake_loss_timer(unsigned long data)
+/*  this function checks whether the socket is already locked, in which case it has to wait
+    until it is released. After that, the "actual" handler function is called. Being a tasklet
+    hrtimer, it runs in softirq context */
+static enum hrtimer_restart quic_timer(struct hrtimer *timer)
 {
-	struct sock *sk = (struct sock *)data;
+	struct quic_sock *qp = container_of(timer, struct quic_sock, quic_timer.timer);
+	struct sock *sk = (struct sock *)qp;
 
 	bh_lock_sock(sk);
+	if (!test_and_clear_bit(QUIC_TIMER_ARMED, &qp->timer_flags)) {
+		//stale expiry, no reference held for it: the events it was for were run already
+		bh_unlock_sock(sk);
+		return HRTIMER_NORESTART;
+	}
+	qp->timer_expires = 0;	//quic_timer_handler() re-arms for what is still pending
+
 	if (!sock_owned_by_user(sk)) {
-		quic_hshake_loss_timer_handler(sk);
+		quic_timer_handler(sk);
 	} else {
 		printk("/* delegate our work to quic_release_cb() */\n");
-		if (!test_and_set_bit(QUIC_HSHAKE_LOSS_TIMER_DEFERRED, &quic_sk(sk)->timer_flags))
+		if (!test_and_set_bit(QUIC_TIMER_DEFERRED, &qp->timer_flags))
 			sock_hold(sk);
 	}
 	bh_unlock_sock(sk);
 	sock_put(sk);
+	return HRTIMER_NORESTART;
 }
 
-//initialize all four timers at the beginning (handshake/loss, RTO/TLP, delayed ACK, early retransmit)
+//initialize the connection timer at the beginning, no event is pending yet
 
 void quic_init_xmit_timers(struct sock *sk)
 {
 	struct quic_sock *qp = quic_sk(sk);
 
-	setup_timer(&qp->quic_hshake_loss_timer, &quic_hshake_loss_timer,
-		(unsigned long)sk);
-	setup_timer(&qp->quic_rto_tlp_timer, &quic_rto_tlp_timer,
-		(unsigned long)sk);
-	setup_timer(&qp->quic_del_ack_timer, &quic_del_ack_timer,
-		(unsigned long)sk);
-	setup_timer(&qp->quic_early_retrans_timer, &quic_early_retrans_timer,
-		(unsigned long)sk);
+	tasklet_hrtimer_init(&qp->quic_timer, quic_timer,
+			     CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+	qp->timer_expires = 0;
+	qp->loss_detection_time = 0;
+	qp->del_ack_time = 0;
 }
-/*  This function checks the timer flags and calls handler functions for those timers which 
-    had fired but couldn't run! */
-void quic_release_cb(struct sock *sk)
+
+//cancel the connection timer and drop the reference it holds (process context only)
+static void quic_stop_xmit_timers(struct sock *sk)
 {
 	struct quic_sock *qp = quic_sk(sk);
-	unsigned long  	flags;
-	flags = qp->timer_flags;
-	memset(&qp->timer_flags, 0, sizeof(qp->timer_flags));
+
+	tasklet_hrtimer_cancel(&qp->quic_timer);
+	qp->timer_expires = 0;
+	if (test_and_clear_bit(QUIC_TIMER_ARMED, &qp->timer_flags))
+		__sock_put(sk);
+}
+/*  This function checks the timer flags and calls handler functions for those timers which 
+    had fired but couldn't run! */
+void quic_release_cb(struct sock *sk)
+{
+	struct quic_sock *qp = quic_sk(sk);
+	unsigned long  	flags, nflags;
+
+	//take the deferred events, the reference bit of the connection timer stays
+	do {
+		flags = qp->timer_flags;
+		if (!(flags & QUIC_DEFERRED_ALL))
+			return;
+		nflags = flags & ~QUIC_DEFERRED_ALL;
+	} while (cmpxchg(&qp->timer_flags, flags, nflags) != flags);
 
 	/* Here begins the tricky part :
 	 * We are called from release_sock() with :
@@ -463,16 +914,13 @@ void quic_release_cb(struct sock *sk)
 	 */
 	sock_release_ownership(sk);
 
-	if (flags & (1UL << QUIC_HSHAKE_LOSS_TIMER_DEFERRED)) {
-		quic_hshake_loss_timer_handler(sk);
+	if (flags & (1UL << QUIC_TIMER_DEFERRED)) {
+		quic_timer_handler(sk);
 		__sock_put(sk);
 	}
-	if (flags & (1UL << QUIC_DEL_ACK_TIMER_DEFERRED)) {
-		quic_del_ack_timer_handler(sk);
-		__sock_put(sk);
-	}
-	if (flags & (1UL << QUIC_RTO_TLP_TIMER_DEFERRED)) {
-		quic_rto_tlp_timer_handler(sk);
+	if (flags & (1UL << QUIC_ACK_DEFERRED)) {
+		if (sk->sk_state == TCP_ESTABLISHED)
+			send_ack(sk);
 		__sock_put(sk);
 	}
 	
@@ -484,6 +932,541 @@ void quic_release_cb(struct sock *sk)
 //****************  Congestion control
 ////*****************************************************************************************
 
+/*  Congestion control algorithms register a quic_congestion_ops, in the same way as TCP's
+    tcp_congestion_ops: CUBIC below is built in and always available, other algorithms are
+    modules registering at runtime. A socket picks its algorithm by name with the QUIC_CONGESTION
+    socket option, otherwise it gets the default of its network namespace (sysctl
+    net.quic.congestion_control) */
+
+static DEFINE_SPINLOCK(quic_cong_list_lock);
+static LIST_HEAD(quic_cong_list);
+
+static struct quic_congestion_ops quic_cubic;
+
+//simple linear search, don't expect many entries! (called with rcu_read_lock or the list lock)
+static struct quic_congestion_ops *quic_ca_find(const char *name)
+{
+	struct quic_congestion_ops *e;
+
+	list_for_each_entry_rcu(e, &quic_cong_list, list) {
+		if (strcmp(e->name, name) == 0)
+			return e;
+	}
+
+	return NULL;
+}
+
+//attach a new congestion control algorithm to the list of available options
+int quic_register_congestion_control(struct quic_congestion_ops *ca)
+{
+	int ret = 0;
+
+	/* all algorithms must implement these */
+	if (!ca->init || !ca->on_ack || !ca->on_loss) {
+		pr_err("%s does not implement required ops\n", ca->name);
+		return -EINVAL;
+	}
+
+	spin_lock(&quic_cong_list_lock);
+	if (quic_ca_find(ca->name)) {
+		pr_notice("%s already registered\n", ca->name);
+		ret = -EEXIST;
+	} else {
+		list_add_tail_rcu(&ca->list, &quic_cong_list);
+		pr_info("QUIC %s registered\n", ca->name);
+	}
+	spin_unlock(&quic_cong_list_lock);
+
+	return ret;
+}
+EXPORT_SYMBOL_GPL(quic_register_congestion_control);
+
+/*  Remove congestion control algorithm, called from the module's remove function. Module
+    ref counts are used to ensure that no socket is still using the algorithm */
+void quic_unregister_congestion_control(struct quic_congestion_ops *ca)
+{
+	spin_lock(&quic_cong_list_lock);
+	list_del_rcu(&ca->list);
+	spin_unlock(&quic_cong_list_lock);
+}
+EXPORT_SYMBOL_GPL(quic_unregister_congestion_control);
+
+//default algorithm of the socket's namespace, with a module reference held; CUBIC as last resort
+static const struct quic_congestion_ops *quic_ca_default(struct sock *sk)
+{
+	struct quic_net *qn = net_generic(sock_net(sk), quic_net_id);
+	struct quic_congestion_ops *ca;
+
+	rcu_read_lock();
+	spin_lock(&quic_cong_list_lock);
+	ca = quic_ca_find(qn->ca_default);
+	spin_unlock(&quic_cong_list_lock);
+	if (!ca || !try_module_get(ca->owner))
+		ca = &quic_cubic;
+	rcu_read_unlock();
+
+	return ca;
+}
+
+//run the init hook of the socket's algorithm, with fresh private data
+static void quic_init_congestion_control(struct sock *sk)
+{
+	struct quic_sock *qp = quic_sk(sk);
+
+	memset(qp->ca_priv, 0, sizeof(qp->ca_priv));
+	qp->ca_ops->init(sk);
+}
+
+//manage refcounts on socket close
+static void quic_cleanup_congestion_control(struct sock *sk)
+{
+	struct quic_sock *qp = quic_sk(sk);
+
+	if (!qp->ca_ops)
+		return;
+	if (!qp->first_ack && qp->ca_ops->release)
+		qp->ca_ops->release(sk);
+	module_put(qp->ca_ops->owner);
+	qp->ca_ops = NULL;
+}
+
+//change congestion control for socket, loading the module "quic-cong-<name>" if needed
+int quic_set_congestion_control(struct sock *sk, const char *name)
+{
+	struct quic_sock *qp = quic_sk(sk);
+	struct quic_congestion_ops *ca;
+	int err = 0;
+
+	rcu_read_lock();
+	ca = quic_ca_find(name);
+
+#ifdef CONFIG_MODULES
+	if (!ca && capable(CAP_NET_ADMIN)) {
+		rcu_read_unlock();
+		request_module("quic-cong-%s", name);
+		rcu_read_lock();
+		ca = quic_ca_find(name);
+	}
+#endif
+
+	/* no change asking for existing value */
+	if (ca == qp->ca_ops)
+		goto out;
+
+	if (!ca)
+		err = -ENOENT;
+	else if (!try_module_get(ca->owner))
+		err = -EBUSY;
+	else {
+		bool initialized = !qp->first_ack;
+
+		quic_cleanup_congestion_control(sk);
+		qp->ca_ops = ca;
+		if (initialized)	//connection already running, switch over right away
+			quic_init_congestion_control(sk);
+	}
+ out:
+	rcu_read_unlock();
+	return err;
+}
+EXPORT_SYMBOL_GPL(quic_set_congestion_control);
+
+//push the pacing rate of the algorithm to the socket, the fq qdisc does the actual pacing
+static inline void quic_update_pacing_rate(struct sock *sk)
+{
+	struct quic_sock *qp = quic_sk(sk);
+	u64 rate;
+
+	if (!qp->ca_ops->pacing_rate)
+		return;
+	rate = qp->ca_ops->pacing_rate(sk);
+	sk->sk_pacing_rate = rate ? min_t(u64, rate, ~0U) : ~0U;
+}
+
+#ifdef CONFIG_SYSCTL
+//net.quic.congestion_control: only names of registered algorithms are accepted
+static int proc_quic_congestion_control(struct ctl_table *ctl, int write,
+				       void __user *buffer, size_t *lenp, loff_t *ppos)
+{
+	char val[QUIC_CA_NAME_MAX];
+	struct ctl_table tbl = {
+		.data = val,
+		.maxlen = QUIC_CA_NAME_MAX,
+	};
+	int ret;
+
+	spin_lock(&quic_cong_list_lock);
+	strlcpy(val, ctl->data, sizeof(val));
+	spin_unlock(&quic_cong_list_lock);
+
+	ret = proc_dostring(&tbl, write, buffer, lenp, ppos);
+	if (write && ret == 0) {
+		spin_lock(&quic_cong_list_lock);
+		if (quic_ca_find(val))
+			strlcpy(ctl->data, val, QUIC_CA_NAME_MAX);
+		else
+			ret = -ENOENT;
+		spin_unlock(&quic_cong_list_lock);
+	}
+	return ret;
+}
+
+static int zero;
+static int one = 1;
+static int reo_wnd_max = 1000;
+static int reordering_max = QUIC_REPLAY_WINDOW / QUIC_MAX_PATHS;	//within the replay window on every path
+static int iw_max = QUIC_MAX_IW;
+static int two = 2;
+
+static struct ctl_table quic_net_table[] = {
+	{
+		.procname	= "congestion_control",
+		.maxlen		= QUIC_CA_NAME_MAX,
+		.mode		= 0644,
+		.proc_handler	= proc_quic_congestion_control,
+	},
+	{
+		.procname	= "reordering",
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &one,
+		.extra2		= &reordering_max,
+	},
+	{
+		.procname	= "max_reordering",
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &one,
+		.extra2		= &reordering_max,
+	},
+	{
+		.procname	= "reordering_window",
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &zero,
+		.extra2		= &reo_wnd_max,
+	},
+	{
+		.procname	= "ecn",
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &zero,
+		.extra2		= &one,
+	},
+	{
+		.procname	= "loss_differentiation",
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &zero,
+		.extra2		= &one,
+	},
+	{
+		.procname	= "zero_rtt",
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &zero,
+		.extra2		= &one,
+	},
+	{
+		.procname	= "initial_window",
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &one,
+		.extra2		= &iw_max,
+	},
+	{
+		.procname	= "syn_cookies",
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &zero,
+		.extra2		= &two,
+	},
+	{ }
+};
+#endif
+
+static int __net_init quic_net_init(struct net *net)
+{
+	struct quic_net *qn = net_generic(net, quic_net_id);
+	int cpu;
+
+	strlcpy(qn->ca_default, quic_cubic.name, QUIC_CA_NAME_MAX);
+	qn->sysctl_reordering = RESEND_THRESHOLD;
+	qn->sysctl_max_reordering = QUIC_MAX_REORDERING;
+	qn->sysctl_reo_wnd = QUIC_REO_WND_MAX;
+	qn->sysctl_ecn = 1;
+	qn->sysctl_loss_diff = 0;
+	qn->sysctl_zero_rtt = 1;
+	qn->sysctl_init_cwnd = IW;
+	qn->sysctl_syn_cookies = 1;
+	spin_lock_init(&qn->metrics_lock);
+	qn->syn_rate = alloc_percpu(struct quic_syn_rate);
+	if (!qn->syn_rate)
+		return -ENOMEM;
+	//jiffies start negative after boot, a zero stamp would not expire for minutes
+	for_each_possible_cpu(cpu)
+		per_cpu_ptr(qn->syn_rate, cpu)->stamp = jiffies;
+#ifdef CONFIG_SYSCTL
+	{
+		struct ctl_table *tbl;
+
+		tbl = kmemdup(quic_net_table, sizeof(quic_net_table), GFP_KERNEL);
+		if (!tbl)
+			goto err_free;
+		tbl[0].data = qn->ca_default;
+		tbl[1].data = &qn->sysctl_reordering;
+		tbl[2].data = &qn->sysctl_max_reordering;
+		tbl[3].data = &qn->sysctl_reo_wnd;
+		tbl[4].data = &qn->sysctl_ecn;
+		tbl[5].data = &qn->sysctl_loss_diff;
+		tbl[6].data = &qn->sysctl_zero_rtt;
+		tbl[7].data = &qn->sysctl_init_cwnd;
+		tbl[8].data = &qn->sysctl_syn_cookies;
+
+		qn->sysctl_hdr = register_net_sysctl(net, "net/quic", tbl);
+		if (!qn->sysctl_hdr) {
+			kfree(tbl);
+			goto err_free;
+		}
+	}
+#endif
+	return 0;
+
+#ifdef CONFIG_SYSCTL
+err_free:
+	free_percpu(qn->syn_rate);
+	return -ENOMEM;
+#endif
+}
+
+static void __net_exit quic_net_exit(struct net *net)
+{
+	struct quic_net *qn = net_generic(net, quic_net_id);
+#ifdef CONFIG_SYSCTL
+	struct ctl_table *tbl = qn->sysctl_hdr->ctl_table_arg;
+
+	unregister_net_sysctl_table(qn->sysctl_hdr);
+	kfree(tbl);
+#endif
+	free_percpu(qn->syn_rate);
+}
+
+static struct pernet_operations quic_net_ops = {
+	.init = quic_net_init,
+	.exit = quic_net_exit,
+	.id   = &quic_net_id,
+	.size = sizeof(struct quic_net),
+};
+
+static int quic_migrate(struct sock *sk);
+static int quic_set_crypto(struct sock *sk, const struct quic_crypto_info *info);
+static void quic_aead_release(struct sock *sk);
+static int quic_hs_establish(struct sock *sk, const struct quic_handshake_info *info);
+
+//socket options at level SOL_QUIC, everything else is handled like UDP
+static int quic_lib_setsockopt(struct sock *sk, int optname,
+			       char __user *optval, unsigned int optlen)
+{
+	struct quic_sock *qp = quic_sk(sk);
+	char name[QUIC_CA_NAME_MAX];
+	struct sockaddr_in addr;
+	struct quic_crypto_info info;
+	struct quic_handshake_info hs;
+	struct quic_transport_params tp;
+	int err, val;
+
+	switch (optname) {
+	case QUIC_CONGESTION:
+		if (optlen < 1)
+			return -EINVAL;
+		optlen = min_t(unsigned int, optlen, QUIC_CA_NAME_MAX - 1);
+		if (copy_from_user(name, optval, optlen))
+			return -EFAULT;
+		name[optlen] = 0;
+
+		lock_sock(sk);
+		err = quic_set_congestion_control(sk, name);
+		release_sock(sk);
+		return err;
+	case QUIC_MIGRATE:
+		lock_sock(sk);
+		err = quic_migrate(sk);
+		release_sock(sk);
+		return err;
+	case QUIC_ADD_PATH:
+		if (optlen < sizeof(addr))
+			return -EINVAL;
+		if (copy_from_user(&addr, optval, sizeof(addr)))
+			return -EFAULT;
+		if (addr.sin_family != AF_INET)
+			return -EAFNOSUPPORT;
+
+		lock_sock(sk);
+		err = quic_mpath_add(sk, addr.sin_addr.s_addr, inet_sk(sk)->inet_daddr,
+				     inet_sk(sk)->inet_dport);
+		release_sock(sk);
+		return err;
+	case QUIC_SCHEDULER:
+		if (optlen < sizeof(int))
+			return -EINVAL;
+		if (get_user(val, (int __user *)optval))
+			return -EFAULT;
+		if (val != QUIC_SCHED_MINRTT && val != QUIC_SCHED_RATE)
+			return -EINVAL;
+
+		lock_sock(sk);
+		qp->mpath_sched = val;
+		release_sock(sk);
+		return 0;
+	case QUIC_FEC:
+		if (optlen < sizeof(int))
+			return -EINVAL;
+		if (get_user(val, (int __user *)optval))
+			return -EFAULT;
+
+		lock_sock(sk);
+		err = 0;
+		/* the peer's parameters are known once the handshake is done, until then
+		 * they are the defaults and quic_tp_apply() turns FEC off if need be */
+		if (val && !(qp->local_tp.features & qp->peer_tp.features & QUIC_TP_FEC))
+			err = -EOPNOTSUPP;
+		if (!err && val && !qp->fec_buf) {
+			qp->fec_buf = kmalloc(sizeof(struct fec_hdr) + QUIC_FEC_MAX_PAYLOAD, GFP_KERNEL);
+			if (!qp->fec_buf)
+				err = -ENOMEM;
+		}
+		if (!err) {
+			qp->fec = !!val;
+			qp->fec_cnt = 0;
+		}
+		release_sock(sk);
+		return err;
+	case QUIC_CRYPTO:
+		if (optlen < sizeof(info))
+			return -EINVAL;
+		if (copy_from_user(&info, optval, sizeof(info)))
+			return -EFAULT;
+
+		lock_sock(sk);
+		err = quic_set_crypto(sk, &info);
+		release_sock(sk);
+		memset(&info, 0, sizeof(info));
+		return err;
+	case QUIC_HANDSHAKE_USER:
+		if (optlen < sizeof(int))
+			return -EINVAL;
+		if (get_user(val, (int __user *)optval))
+			return -EFAULT;
+
+		lock_sock(sk);
+		err = sk->sk_state == TCP_CLOSE ? 0 : -EISCONN;
+		if (!err)
+			qp->hs_user = !!val;
+		release_sock(sk);
+		return err;
+	case QUIC_ESTABLISH:
+		if (optlen < sizeof(hs))
+			return -EINVAL;
+		if (copy_from_user(&hs, optval, sizeof(hs)))
+			return -EFAULT;
+		return quic_hs_establish(sk, &hs);
+	case QUIC_TRANSPORT_PARAMS:
+		if (optlen < sizeof(tp))
+			return -EINVAL;
+		if (copy_from_user(&tp, optval, sizeof(tp)))
+			return -EFAULT;
+		if (tp.max_ack_delay > QUIC_MAX_ACK_DELAY || tp.max_pkt < QUIC_MSS ||
+		    (tp.rcv_wnd && tp.rcv_wnd < QUIC_MIN_CWND))
+			return -EINVAL;
+
+		lock_sock(sk);
+		err = sk->sk_state == TCP_CLOSE ? 0 : -EISCONN;
+		if (!err)
+			qp->local_tp = tp;
+		release_sock(sk);
+		return err;
+	default:
+		return -ENOPROTOOPT;
+	}
+}
+
+static int quic_lib_getsockopt(struct sock *sk, int optname,
+			       char __user *optval, int __user *optlen)
+{
+	struct quic_sock *qp = quic_sk(sk);
+	int len;
+
+	if (get_user(len, optlen))
+		return -EFAULT;
+	if (len < 0)
+		return -EINVAL;
+
+	switch (optname) {
+	case QUIC_CONGESTION:
+		len = min_t(unsigned int, len, QUIC_CA_NAME_MAX);
+		if (put_user(len, optlen))
+			return -EFAULT;
+		if (copy_to_user(optval, qp->ca_ops->name, len))
+			return -EFAULT;
+		return 0;
+	case QUIC_SCHEDULER:
+		if (len < sizeof(int))
+			return -EINVAL;
+		len = sizeof(int);
+		if (put_user(len, optlen) || put_user((int)qp->mpath_sched, (int __user *)optval))
+			return -EFAULT;
+		return 0;
+	case QUIC_FEC:
+		if (len < sizeof(int))
+			return -EINVAL;
+		len = sizeof(int);
+		if (put_user(len, optlen) || put_user((int)qp->fec, (int __user *)optval))
+			return -EFAULT;
+		return 0;
+	case QUIC_HANDSHAKE_USER:
+		if (len < sizeof(int))
+			return -EINVAL;
+		len = sizeof(int);
+		if (put_user(len, optlen) || put_user((int)qp->hs_user, (int __user *)optval))
+			return -EFAULT;
+		return 0;
+	case QUIC_TRANSPORT_PARAMS:
+		if (len < sizeof(qp->peer_tp))
+			return -EINVAL;
+		len = sizeof(qp->peer_tp);
+		if (put_user(len, optlen) || copy_to_user(optval, &qp->peer_tp, len))
+			return -EFAULT;
+		return 0;
+	default:
+		return -ENOPROTOOPT;
+	}
+}
+
+int quic_setsockopt(struct sock *sk, int level, int optname,
+		    char __user *optval, unsigned int optlen)
+{
+	if (level == SOL_QUIC)
+		return quic_lib_setsockopt(sk, optname, optval, optlen);
+	return udp_setsockopt(sk, level, optname, optval, optlen);
+}
+
+int quic_getsockopt(struct sock *sk, int level, int optname,
+		    char __user *optval, int __user *optlen)
+{
+	if (level == SOL_QUIC)
+		return quic_lib_getsockopt(sk, optname, optval, optlen);
+	return udp_getsockopt(sk, level, optname, optval, optlen);
+}
+
+
 
 //void increase_cwnd(struct sock *sk, unsigned int count){
 //	struct quic_sock *qp = quic_sk(sk);
@@ -505,7 +1488,20 @@ void quic_release_cb(struct sock *sk)
 //
 //}
 
-//CONGESTION CONTROL: QUIC uses the TCP Cubic congestion control algorithm
+//CONGESTION CONTROL: QUIC uses the TCP Cubic congestion control algorithm by default
+
+//CUBIC tunables, the same for every socket (precomputed factors are set in quic_cubic_register())
+static int fast_convergence __read_mostly = 1;
+static int beta __read_mostly = 717;	/* = 717/1024 (BICTCP_BETA_SCALE) */
+static int initial_ssthresh __read_mostly = UINT_MAX;
+static int bic_scale __read_mostly = 41;
+static int tcp_friendliness __read_mostly = 1;
+
+static int hystart __read_mostly = 1;
+
+static u32 cube_rtt_scale __read_mostly;
+static u32 beta_scale __read_mostly;
+static u64 cube_factor __read_mostly;
 
 //reset control structure
 static inline void bictcp_reset(struct quic_bictcp *ca)
@@ -518,42 +1514,73 @@ static inline void bictcp_reset(struct quic_bictcp *ca)
 	ca->bic_K = 0;
 	ca->delay_min = 0;
 	ca->epoch_start = 0;
-	ca->delayed_ack = 2 << ACK_RATIO_SHIFT;
 	ca->ack_cnt = 0;
 	ca->tcp_cwnd = 0;
-	ca->found = 0;
-}
-//convert current time from boot (jiffies) to msecs
-static inline u32 bictcp_clock(void)
-{
-	return jiffies_to_msecs(jiffies);
+	ca->css_baseline = 0;
+	ca->css_rounds = 0;
+	ca->css_acked = 0;
 }
-//resetting the whole algorithm(?)
+/*  Start of a HyStart++ round: a round ends when the first packet sent after its start is
+    ACKed, so rounds are delimited by transmission sequence numbers and not by time */
 static inline void bictcp_hystart_reset(struct sock *sk)
 {
 	struct quic_sock *qp = quic_sk(sk);
-	struct quic_bictcp *ca = &qp->ca;
+	struct quic_bictcp *ca = quic_ca(sk);
 
-	ca->round_start = ca->last_ack = bictcp_clock();    
-	ca->end_seq = qp->send_next;
+	ca->end_seq = qp->send_next_sequence;
+	ca->last_rtt = ca->curr_rtt;
 	ca->curr_rtt = 0;
 	ca->sample_cnt = 0;
+
+	//enough rounds in conservative slow start without a false exit: congestion avoidance
+	if (ca->css_baseline && ++ca->css_rounds >= HYSTART_CSS_ROUNDS) {
+		qp->ssthresh = qp->cwnd;
+		ca->css_baseline = 0;
+	}
+}
+
+//HyStart++ only runs in the initial slow start, later slow starts are standard ones
+static inline bool bictcp_in_hystart(const struct sock *sk)
+{
+	return hystart && quic_sk(sk)->ssthresh == UINT_MAX;
 }
 
 //initializing TCP Cubic algorithm
 static void bictcp_init(struct sock *sk)
 {
 	struct quic_sock *qp = quic_sk(sk);
-	struct quic_bictcp *ca = &qp->ca;
+	struct quic_bictcp *ca = quic_ca(sk);
 
 	bictcp_reset(ca);
 	ca->loss_cwnd = 0;
 
-	if (qp->hystart)
+	if (hystart)
 		bictcp_hystart_reset(sk);
 
-	if (!qp->hystart && qp->initial_ssthresh)
-		qp->ssthresh = qp->initial_ssthresh;
+	if (!hystart && initial_ssthresh)
+		qp->ssthresh = initial_ssthresh;
+}
+
+//Recalculating threshold after a loss event
+static u32 bictcp_recalc_ssthresh(struct sock *sk)
+{
+	struct quic_sock *qp = quic_sk(sk); /* see quic.h - finally found it */
+	struct quic_bictcp *ca = quic_ca(sk); /* see thesis for complete definition (...) */
+	u32 segs = qp->cwnd / QUIC_MSS;	/* the cubic function is computed in packets */
+
+	ca->epoch_start = 0;	/* end of epoch, beginning of new one */
+
+//special case considered: fast convergence
+	/* Wmax and fast convergence */
+	if (segs < ca->last_max_cwnd && fast_convergence)
+		ca->last_max_cwnd = (segs * (BICTCP_BETA_SCALE + beta))
+			/ (2 * BICTCP_BETA_SCALE);
+	else
+		ca->last_max_cwnd = segs;
+//save previous congestion window
+	ca->loss_cwnd = qp->cwnd;
+//1024 as scale factor for beta calculation
+	return max_t(u32, div_u64((u64)qp->cwnd * beta, BICTCP_BETA_SCALE), QUIC_MIN_CWND); //2 packets as smallest threshold
 }
 
 
@@ -610,13 +1637,12 @@ static u32 cubic_root(u64 a)
 /*
  * Compute congestion window to use. (update congestion window after each positive ACK)
  */
-static inline void bictcp_update(struct sock *sk, struct quic_bictcp *ca, u32 cwnd)
+static inline void bictcp_update(struct sock *sk, struct quic_bictcp *ca, u32 cwnd, u32 acked)
 {
-	struct quic_sock *qp = quic_sk(sk);
 	u32 delta, bic_target, max_cnt;
 	u64 offs, t;
 
-	ca->ack_cnt++;	/* count the number of ACKs */
+	ca->ack_cnt += acked;	/* count the number of bytes acked */
 
 	if (ca->last_cwnd == cwnd &&
 	    (s32)(jiffies - ca->last_time) <= HZ / 32)
@@ -627,7 +1653,7 @@ static inline void bictcp_update(struct sock *sk, struct quic_bictcp *ca, u32 cw
 
 	if (ca->epoch_start == 0) {     /* epoch has been ended (see in the first lines...) */
 		ca->epoch_start = jiffies;	/* record the beginning of an epoch */
-		ca->ack_cnt = 1;			/* start counting (first ACK) */
+		ca->ack_cnt = acked;			/* start counting (first ACK) */
 		ca->tcp_cwnd = cwnd;			/* syn with cubic */
 
 		if (ca->last_max_cwnd <= cwnd) {
@@ -637,7 +1663,7 @@ static inline void bictcp_update(struct sock *sk, struct quic_bictcp *ca, u32 cw
 			/* Compute new K based on
 			 * (wmax-cwnd) * (srtt>>3 / HZ) / c * 2^(3*bictcp_HZ)
 			 */
-			ca->bic_K = cubic_root(qp->cube_factor
+			ca->bic_K = cubic_root(cube_factor
 					       * (ca->last_max_cwnd - cwnd));
 			ca->bic_origin_point = ca->last_max_cwnd;
 		}
@@ -658,7 +1684,7 @@ static inline void bictcp_update(struct sock *sk, struct quic_bictcp *ca, u32 cw
 	 */
 
 	t = (s32)(jiffies - ca->epoch_start);
-	t += msecs_to_jiffies(ca->delay_min >> 3);
+	t += usecs_to_jiffies(ca->delay_min);
 	/* change the unit from HZ to bictcp_HZ */
 	t <<= BICTCP_HZ;
 	do_div(t, HZ);
@@ -669,7 +1695,7 @@ static inline void bictcp_update(struct sock *sk, struct quic_bictcp *ca, u32 cw
 		offs = t - ca->bic_K;
 
 	/* c/rtt * (t-K)^3 */
-	delta = (qp->cube_rtt_scale * offs * offs * offs) >> (10+3*BICTCP_HZ);
+	delta = (cube_rtt_scale * offs * offs * offs) >> (10+3*BICTCP_HZ);
 	if (t < ca->bic_K)                                	/* below origin*/
 		bic_target = ca->bic_origin_point - delta;
 	else                                                	/* above origin*/
@@ -690,9 +1716,9 @@ static inline void bictcp_update(struct sock *sk, struct quic_bictcp *ca, u32 cw
 		ca->cnt = 20;	/* increase cwnd 5% per RTT */
 
 	/* TCP Friendly (???) */
-	if (qp->tcp_friendliness) {
-		u32 scale = qp->beta_scale;
-		delta = (cwnd * scale) >> 3;
+	if (tcp_friendliness) {
+		u32 scale = beta_scale;
+		delta = ((cwnd * scale) >> 3) * QUIC_MSS;
 		while (ca->ack_cnt > delta) {		/* update tcp cwnd */
 			ca->ack_cnt -= delta;
 			ca->tcp_cwnd++;
@@ -706,7 +1732,6 @@ static inline void bictcp_update(struct sock *sk, struct quic_bictcp *ca, u32 cw
 		}
 	}
     
-	ca->cnt = (ca->cnt << ACK_RATIO_SHIFT) / ca->delayed_ack;
 	if (ca->cnt == 0)			/* cannot be zero */
 		ca->cnt = 1;            //minimum count = 1
 }
@@ -747,26 +1772,27 @@ int quic_slow_start(struct sock *sk, u32 acked)
         acked -= cwnd - qp->cwnd;                       //if something has been left unacked due to overflow
         return acked;
 }
-//Congestion avoidance: Additive increase
-void quic_cong_avoid_ai(struct sock *sk, u32 w)
+//Congestion avoidance: Additive increase, one packet per w packets worth of bytes ACKed
+void quic_cong_avoid_ai(struct sock *sk, u32 w, u32 acked)
 {
 	struct quic_sock *qp = quic_sk(sk);
-    //each ACKed packet leads to cwnd incerase by 1, until UINT_MAX reached
-	printk("cwnd_cnt = %u, cnt needed = %u\n", qp->cwnd_cnt, w);
-        if (qp->cwnd_cnt >= w) {
-                if (qp->cwnd < UINT_MAX)
-                        qp->cwnd++;
-                qp->cwnd_cnt = 0;
-        } else {
-                qp->cwnd_cnt++;
+	u32 bytes = w * QUIC_MSS;
+
+	qp->cwnd_cnt += acked;
+	pr_debug("cwnd_cnt = %u, cnt needed = %u\n", qp->cwnd_cnt, bytes);
+        if (qp->cwnd_cnt >= bytes) {
+                u32 delta = qp->cwnd_cnt / bytes;
+
+                qp->cwnd_cnt -= delta * bytes;
+                if (qp->cwnd < UINT_MAX - delta * QUIC_MSS)
+                        qp->cwnd += delta * QUIC_MSS;
         }
 }
 //calls slow start and congestion avoidance functions as needed
-static void bictcp_cong_avoid(struct sock *sk, u32 ack, u32 acked,
-			      u32 in_flight)
+static void bictcp_cong_avoid(struct sock *sk, u32 acked, u32 in_flight)
 {
 	struct quic_sock *qp = quic_sk(sk);
-	struct quic_bictcp *ca = &qp->ca;
+	struct quic_bictcp *ca = quic_ca(sk);
     //no need to increment the congestion window!
 	if (!quic_is_cwnd_limited(sk, in_flight)){
 		printk("bictcp_cong_avoid(): Not limited by congestion window\n");
@@ -774,81 +1800,79 @@ static void bictcp_cong_avoid(struct sock *sk, u32 ack, u32 acked,
 	}
 
 	if (qp->cwnd < qp->ssthresh) {
-		printk("bictcp_cong_avoid(): In slow start\n");
-		if (qp->hystart && (ack > ca->end_seq))         //checks if a reset is necessary
-			bictcp_hystart_reset(sk);
-		quic_slow_start(sk, acked);
+		if (!bictcp_in_hystart(sk)) {
+			printk("bictcp_cong_avoid(): In slow start\n");
+			quic_slow_start(sk, acked);
+		} else if (!ca->css_baseline) {
+			pr_debug("bictcp_cong_avoid(): In HyStart++ slow start\n");
+			quic_slow_start(sk, min_t(u32, acked, HYSTART_L * QUIC_MSS));
+		} else {
+			//conservative slow start: a quarter of the slow start increase, the remainder
+			//of the division is carried to the next ACK
+			u32 inc = ca->css_acked + min_t(u32, acked, HYSTART_L * QUIC_MSS);
+
+			pr_debug("bictcp_cong_avoid(): In HyStart++ conservative slow start\n");
+			qp->cwnd += inc / HYSTART_CSS_GROWTH_DIVISOR;
+			ca->css_acked = inc % HYSTART_CSS_GROWTH_DIVISOR;
+		}
 	} else {
 		printk("bictcp_cong_avoid(): In Congestion avoidance\n");
-		bictcp_update(sk, ca, qp->cwnd);                //Cubic TCP update
-		quic_cong_avoid_ai(sk, ca->cnt);
+		bictcp_update(sk, ca, qp->cwnd / QUIC_MSS, acked);   //Cubic TCP update
+		quic_cong_avoid_ai(sk, ca->cnt, acked);
 	}
 
 }
-/*  Returns maximum of actual congestion window and congestion window at last loss. Used if a packet other than 
-    the one sent after RTO is acked (i.e. things have unexpectedly gone well after we had given up hope) */
+/*  Returns maximum of actual congestion window and congestion window at last loss. Used when every loss of
+    a recovery period turned out to be spurious (i.e. things have unexpectedly gone well after we had given up hope) */
 static u32 bictcp_undo_cwnd(struct sock *sk)
 {
 	struct quic_sock *qp = quic_sk(sk);
-	struct quic_bictcp *ca = &qp->ca;
+	struct quic_bictcp *ca = quic_ca(sk);
 
 	return max(qp->cwnd, ca->loss_cwnd);
 }
 
 
-//HYSTART = TCP Cubic slow start algorithm. Two heuristics to exit slow start before losses start to occur.
+/*  HyStart++ (RFC 9406): the minimum RTT of each round is compared with the one of the previous
+    round. A clear increase means a queue builds up, and slow start switches to the conservative
+    slow start (CSS) instead of overshooting. If the RTT falls below the baseline again the exit
+    was premature and slow start resumes; after HYSTART_CSS_ROUNDS rounds in CSS congestion
+    avoidance begins */
 static void hystart_update(struct sock *sk, u32 delay)
 {
-	struct quic_sock *qp = quic_sk(sk);
-	struct quic_bictcp *ca = &qp->ca;
-
-	if (!(ca->found & qp->hystart_detect)) {
-		u32 now = bictcp_clock();
-
-		/* first detection parameter - ack-train detection */
-		if ((s32)(now - ca->last_ack) <= qp->hystart_ack_delta) {
-			ca->last_ack = now;
-			if ((s32)(now - ca->round_start) > ca->delay_min >> 4)
-				ca->found |= HYSTART_ACK_TRAIN;
-		}
-
-		/* obtain the minimum delay of more than sampling packets */
-		if (ca->sample_cnt < HYSTART_MIN_SAMPLES) {
-			if (ca->curr_rtt == 0 || ca->curr_rtt > delay)
-				ca->curr_rtt = delay;
-
-			ca->sample_cnt++;
-		} else {
-			if (ca->curr_rtt > ca->delay_min +
-			    HYSTART_DELAY_THRESH(ca->delay_min>>4))
-				ca->found |= HYSTART_DELAY;
+	struct quic_bictcp *ca = quic_ca(sk);
+	u32 thresh;
+
+	if (ca->curr_rtt == 0 || ca->curr_rtt > delay)
+		ca->curr_rtt = delay;
+	if (ca->sample_cnt < HYSTART_N_RTT_SAMPLE)
+		ca->sample_cnt++;
+
+	if (ca->sample_cnt < HYSTART_N_RTT_SAMPLE || !ca->last_rtt)
+		return;		//not enough samples in this round or no previous round yet
+
+	if (!ca->css_baseline) {
+		thresh = HYSTART_RTT_THRESH(ca->last_rtt / HYSTART_MIN_RTT_DIVISOR);
+		if (ca->curr_rtt >= ca->last_rtt + thresh) {
+			ca->css_baseline = ca->curr_rtt;
+			ca->css_rounds = 0;
+			ca->css_acked = 0;
+			printk("HyStart++: RTT increased from %uus to %uus, entering CSS\n",
+			       ca->last_rtt, ca->curr_rtt);
 		}
-		/*
-		 * Either one of two conditions are met,
-		 * we exit from slow start immediately.
-		 */
-		if (ca->found & qp->hystart_detect)
-			qp->ssthresh = qp->cwnd;
+	} else if (ca->curr_rtt < ca->css_baseline) {
+		ca->css_baseline = 0;	//spurious exit, back to slow start
+		printk("HyStart++: RTT back to %uus, leaving CSS\n", ca->curr_rtt);
 	}
 }
 
 
 //Called when new packets have been acked
-static void bictcp_acked(struct sock *sk, u32 cnt, s32 rtt)
+static void bictcp_acked(struct sock *sk, s32 rtt)
 {
-	struct quic_sock *qp = quic_sk(sk);
-	struct quic_bictcp *ca = &qp->ca;
+	struct quic_bictcp *ca = quic_ca(sk);
 	u32 delay;
 
-	if (qp->ca_state == QUIC_CA_Open) {
-		u32 ratio = ca->delayed_ack;
-
-		ratio -= ca->delayed_ack >> ACK_RATIO_SHIFT;
-		ratio += cnt;
-
-		ca->delayed_ack = clamp(ratio, 1U, ACK_RATIO_LIMIT);
-	}
-
 	/* Some calls are for duplicates without timestamps */
 	if (rtt < 0)
 		return;
@@ -857,7 +1881,7 @@ static void bictcp_acked(struct sock *sk, u32 cnt, s32 rtt)
 	if (ca->epoch_start && (s32)(jiffies - ca->epoch_start) < HZ)
 		return;
 
-	delay = (rtt << 3);
+	delay = rtt;
 	if (delay == 0)
 		delay = 1;
 
@@ -865,75 +1889,66 @@ static void bictcp_acked(struct sock *sk, u32 cnt, s32 rtt)
 	if (ca->delay_min == 0 || ca->delay_min > delay)
 		ca->delay_min = delay;
 
-	/* hystart triggers when cwnd is larger than some threshold */
-	if (qp->hystart && qp->cwnd <= qp->ssthresh &&
-	    qp->cwnd >= qp->hystart_low_window)
-		hystart_update(sk, delay); //should we exit the slow start phase, even if we're under SSthresh?
+	/* every RTT sample of the initial slow start feeds HyStart++ */
+	if (bictcp_in_hystart(sk))
+		hystart_update(sk, delay);
 }
 
-//***********************************************************************************************
-//***********************************************************************************************
-
-static inline int quic_sk_init(struct sock *sk)
+//New ACK: a HyStart++ round may end, the RTT sample is taken, then the window grows outside of recovery
+static void cubic_on_ack(struct sock *sk, const struct quic_ack_sample *rs,
+			 u32 prior_in_flight, s32 rtt)
 {
 	struct quic_sock *qp = quic_sk(sk);
+	struct quic_bictcp *ca = quic_ca(sk);
 
-	sk->sk_state = TCP_CLOSE;
-	printk("Set the QUIC socket state to TCP_CLOSE\n");
-	__skb_queue_head_init(&sk->sk_write_queue);
-	__skb_queue_head_init(&sk->quic_receive_queue);
+	if (bictcp_in_hystart(sk) && !before(qp->highest_ack_sequence, ca->end_seq))
+		bictcp_hystart_reset(sk);
 
-	qp->first_unack = qp->send_next = qp->send_next_sequence = qp->rcv_next = qp->highest_rcv = 0;
-	qp->syn_acked = 0;
-	//memset(qp, 0, sizeof(struct quic_sock));
-	//
-	qp->packets_out = 0;
-	qp->tlp_out = 0;
-	qp->nacked_in_q = 0;
-	qp->first_nack = 0;
-	qp->sending = 0;
-	qp->last_sent = NULL;
-	qp->server = 0;
-	
-	//Init the Timers
-	quic_init_xmit_timers(sk);
-	memset(&qp->timer_flags, 0, sizeof(qp->timer_flags));
+	if (rs->acked)
+		bictcp_acked(sk, rtt);
 
-	//Set the initial RTO to 1s
-	qp->rto = HZ;
-	qp->srtt = 20<<3; //SRTT value is stored in multiple of 8
-	qp->rttvar = 0;
-	qp->mdev = 0;
-	qp->mdev_max = 0;
-	qp->rtt_seq = 0;
-	qp->first_rtt = 1;
-	qp->first_ack = 1;
+	if (qp->ca_state != QUIC_CA_Recovery)
+		bictcp_cong_avoid(sk, rs->acked_bytes, prior_in_flight);
+}
+
+//Start of a recovery period: multiplicative decrease
+static void cubic_on_loss(struct sock *sk, const struct quic_ack_sample *rs)
+{
+	struct quic_sock *qp = quic_sk(sk);
+	struct quic_bictcp *ca = quic_ca(sk);
 
-	qp->number_rto_packets = 0;
+	qp->ssthresh = bictcp_recalc_ssthresh(sk);
+	qp->cwnd = qp->ssthresh;
+	ca->css_baseline = 0;	//a loss ends slow start, CSS included
+}
 
-	//Congestion Control************************************************************
-	qp->cwnd = IW;
-	qp->cwnd_cnt = 0;
-	qp->ssthresh = UINT_MAX;
+//Persistent congestion: start over with a new epoch and slow start
+static void cubic_on_rto(struct sock *sk)
+{
+	bictcp_reset(quic_ca(sk));
+	bictcp_hystart_reset(sk);
+}
+
+static struct quic_congestion_ops quic_cubic = {
+	.init		= bictcp_init,
+	.on_ack		= cubic_on_ack,
+	.on_loss	= cubic_on_loss,
+	.on_rto		= cubic_on_rto,
+	.undo		= bictcp_undo_cwnd,
+	.owner		= THIS_MODULE,
+	.name		= "cubic",
+};
+
+static int __init quic_cubic_register(void)
+{
+	BUILD_BUG_ON(sizeof(struct quic_bictcp) > QUIC_CA_PRIV_SIZE);
 
-	qp->fast_convergence  = 1;
-	qp->beta  = 717;	/* = 717/1024 (BICTCP_BETA_SCALE) */
-	qp->initial_ssthresh = UINT_MAX;
-	qp->bic_scale  = 41;
-	qp->tcp_friendliness  = 1;
-	
-	qp->hystart  = 1;
-	qp->hystart_detect  = HYSTART_ACK_TRAIN | HYSTART_DELAY;
-	qp->hystart_low_window  = 16;
-	qp->hystart_ack_delta  = 2;
-    //initial congestion window is set to 2
 	/* Precompute a bunch of the scaling factors that are used per-packet
 	 * based on SRTT of 100ms
 	 */
+	beta_scale = 8*(BICTCP_BETA_SCALE+beta)/ 3 / (BICTCP_BETA_SCALE - beta);
 
-	qp->beta_scale = 8*(BICTCP_BETA_SCALE+qp->beta)/ 3 / (BICTCP_BETA_SCALE - qp->beta);
-
-	qp->cube_rtt_scale = (qp->bic_scale * 10);	/* 1024*c/rtt */
+	cube_rtt_scale = (bic_scale * 10);	/* 1024*c/rtt */
 
 	/* calculate the "K" for (wmax-cwnd) = c/rtt * K^3
 	 *  so K = cubic_root( (wmax-cwnd)*rtt/c )
@@ -949,37 +1964,541 @@ static inline int quic_sk_init(struct sock *sk)
 	 */
 
 	/* 1/c * 2^2*bictcp_HZ * srtt */
-	qp->cube_factor = 1ull << (10+3*BICTCP_HZ); /* 2^40 */
+	cube_factor = 1ull << (10+3*BICTCP_HZ); /* 2^40 */
 
 	/* divide by bic_scale and by constant Srtt (100ms) */
-	do_div(qp->cube_factor, qp->bic_scale * 10);
+	do_div(cube_factor, bic_scale * 10);
 
-	printk("HZ = %u\n, initial CWND = %u, SSTHRESH = %u\n", qp->rto, qp->cwnd, qp->ssthresh);
-	
-	return 0;
+	return quic_register_congestion_control(&quic_cubic);
+}
 
+/*  LEDBAT (RFC 6817): low priority "scavenger" congestion control for background transfers,
+    selected per socket with QUIC_CONGESTION "ledbat". The window grows while the queueing delay
+    (minimum RTT of the round above the base delay) stays below ledbat_target and shrinks in
+    proportion to the excess, so it leaves the bottleneck to any loss based flow that builds a
+    queue. The base delay is the smallest RTT seen in the last two LEDBAT_BASE_WIN windows, so a
+    longer path is picked up after a route change */
+
+#define LEDBAT_BASE_WIN		(60 * USEC_PER_SEC)
+
+static int ledbat_target __read_mostly = 25 * USEC_PER_MSEC;	/* queueing delay target (us) */
+
+static void ledbat_init(struct sock *sk)
+{
+	struct quic_ledbat *lb = quic_ca(sk);
+
+	lb->bic.curr_rtt = ~0U;
+	lb->base_next = ~0U;
+	lb->base_stamp = QUIC_TIMESTAMP;
 }
 
-//timers are cleared, queue is emptied, state is changed to "TCP_CLOSE"; only after that, socket is released
+//base delay and per round minimum delay from one RTT sample
+static void ledbat_delay_update(struct sock *sk, u32 delay)
+{
+	struct quic_ledbat *lb = quic_ca(sk);
+	struct quic_bictcp *ca = &lb->bic;
+	u32 now = QUIC_TIMESTAMP;
 
-static inline void quic_lib_close(struct sock *sk, long timeout)
+	if (delay == 0)
+		delay = 1;
+	ca->curr_rtt = min(ca->curr_rtt, delay);
+	lb->base_next = min(lb->base_next, delay);
+	if (ca->delay_min == 0 || ca->delay_min > delay)
+		ca->delay_min = delay;
+
+	//forget delays older than two windows
+	if ((s32)(now - lb->base_stamp) > LEDBAT_BASE_WIN) {
+		ca->delay_min = lb->base_next;
+		lb->base_next = delay;
+		lb->base_stamp = now;
+	}
+}
+
+static void ledbat_on_ack(struct sock *sk, const struct quic_ack_sample *rs,
+			  u32 prior_in_flight, s32 rtt)
 {
-	struct sk_buff *skb;
+	struct quic_sock *qp = quic_sk(sk);
+	struct quic_ledbat *lb = quic_ca(sk);
+	struct quic_bictcp *ca = &lb->bic;
+	s32 queue_delay, off_target;
+	s64 scale;
+	s32 delta;
+
+	if (!before(qp->highest_ack_sequence, ca->end_seq)) {	/* a new round */
+		ca->end_seq = qp->send_next_sequence;
+		ca->curr_rtt = ~0U;
+	}
+	if (rtt >= 0)
+		ledbat_delay_update(sk, rtt);
 
+	if (!rs->acked || qp->ca_state == QUIC_CA_Recovery || ca->curr_rtt == ~0U)
+		return;
+	if (!quic_is_cwnd_limited(sk, prior_in_flight))
+		return;
 
-	quic_clear_hshake_loss_timer(sk);
-	quic_clear_rto_tlp_timer(sk);
-	quic_clear_del_ack_timer(sk);
-	quic_clear_early_retrans_timer(sk);
+	queue_delay = ca->curr_rtt - ca->delay_min;
 
-	while(!skb_queue_empty(&sk->sk_write_queue)){
-		skb = skb_peek(&sk->sk_write_queue);
-		skb_unlink(skb, &sk->sk_write_queue);
-		kfree_skb(skb);
+	/* slow start until half the target is queued */
+	if (qp->cwnd < qp->ssthresh) {
+		if (queue_delay < ledbat_target / 2) {
+			quic_slow_start(sk, rs->acked_bytes);
+			return;
+		}
+		qp->ssthresh = qp->cwnd;
 	}
-	printk("Emptied the send queue....");
-	sk->sk_state = TCP_CLOSE;
-	printk("Closing socket.........\n");
+
+	/* cwnd += GAIN * off_target / TARGET * bytes acked * MSS / cwnd, with GAIN = 1 */
+	off_target = ledbat_target - queue_delay;
+	lb->cwnd_acc += (s64)off_target * rs->acked_bytes * QUIC_MSS;
+	scale = (s64)ledbat_target * qp->cwnd;
+	delta = div64_s64(lb->cwnd_acc, scale);
+	if (!delta)
+		return;
+	lb->cwnd_acc -= delta * scale;
+
+	if (delta < 0 && -delta >= (s32)qp->cwnd)
+		qp->cwnd = QUIC_MIN_CWND;
+	else
+		qp->cwnd = max_t(s32, qp->cwnd + delta, QUIC_MIN_CWND);
+	/* never more than one packet above what is in flight */
+	qp->cwnd = min(qp->cwnd, prior_in_flight + QUIC_MSS);
+}
+
+static void ledbat_on_loss(struct sock *sk, const struct quic_ack_sample *rs)
+{
+	struct quic_sock *qp = quic_sk(sk);
+	struct quic_ledbat *lb = quic_ca(sk);
+
+	lb->bic.loss_cwnd = qp->cwnd;
+	qp->ssthresh = max_t(u32, qp->cwnd >> 1, QUIC_MIN_CWND);
+	qp->cwnd = qp->ssthresh;
+	lb->cwnd_acc = 0;
+}
+
+static void ledbat_on_rto(struct sock *sk)
+{
+	struct quic_ledbat *lb = quic_ca(sk);
+
+	lb->cwnd_acc = 0;
+}
+
+static struct quic_congestion_ops quic_ledbat = {
+	.init		= ledbat_init,
+	.on_ack		= ledbat_on_ack,
+	.on_loss	= ledbat_on_loss,
+	.on_rto		= ledbat_on_rto,
+	.undo		= bictcp_undo_cwnd,
+	.owner		= THIS_MODULE,
+	.name		= "ledbat",
+};
+
+static int __init quic_ledbat_register(void)
+{
+	BUILD_BUG_ON(sizeof(struct quic_ledbat) > QUIC_CA_PRIV_SIZE);
+
+	return quic_register_congestion_control(&quic_ledbat);
+}
+
+//***********************************************************************************************
+//***********************************************************************************************
+
+// ****   Per-destination metrics
+// *****************************************************************************************
+/*  As TCP's tcp_metrics.c: when a connection closes, its RTT, ssthresh and delivery rate are
+    kept for its destination, and the next connection to it starts from them instead of the
+    defaults. The cache is a small direct-mapped table per network namespace; a destination
+    hashing to a taken slot evicts it. The client side 0-RTT token of a server lives there too */
+
+static struct quic_metrics *quic_metrics_get(struct quic_net *qn, __be32 daddr, bool create){
+	struct quic_metrics *m = &qn->metrics[jhash_1word((__force u32)daddr, 0) &
+					      (QUIC_METRICS_CACHE_SIZE - 1)];
+
+	if(m->daddr == daddr)
+		return m;
+	if(!create)
+		return NULL;
+	memset(m, 0, sizeof(*m));
+	m->daddr = daddr;
+	m->stamp = jiffies;
+	return m;
+}
+
+//seed a connection from the cached metrics of its destination, once that is known
+static void quic_init_metrics(struct sock *sk){
+	struct quic_sock *qp = quic_sk(sk);
+	struct quic_net *qn = net_generic(sock_net(sk), quic_net_id);
+	struct quic_metrics *m;
+	u64 bdp;
+
+	spin_lock_bh(&qn->metrics_lock);
+	m = quic_metrics_get(qn, inet_sk(sk)->inet_daddr, false);
+	if(!m || time_after(jiffies, m->stamp + QUIC_METRICS_TIMEOUT))
+		goto out;
+	//taken as an estimate only: the first sample of this connection replaces it (first_rtt stays set)
+	if(m->srtt){
+		qp->srtt = m->srtt;
+		qp->mdev = qp->mdev_max = qp->rttvar = max_t(u32, m->rttvar, QUIC_RTO_MIN);
+		qp->rto = min_t(u32, (qp->srtt >> 3) + qp->rttvar, QUIC_RTO_MAX);
+	}
+	if(m->ssthresh)
+		qp->ssthresh = max_t(u32, m->ssthresh, QUIC_MIN_CWND);
+	/*  start with half the last bandwidth-delay product, as far as the last ssthresh and the
+	    largest initial window net.quic.initial_window takes allow: a rate learned long ago or on
+	    a path that changed since must not start a burst of hundreds of packets */
+	if(m->rate && m->srtt && !time_after(jiffies, m->stamp + QUIC_METRICS_RATE_TIMEOUT)){
+		bdp = div_u64((u64)m->rate * (m->srtt >> 3), USEC_PER_SEC);
+		bdp = min_t(u64, bdp >> 1, min_t(u32, qp->ssthresh, QUIC_MAX_IW * QUIC_MSS));
+		qp->cwnd = max_t(u32, qp->cwnd, bdp);
+	}
+	printk("Metrics for %pI4: SRTT = %uus, SSTHRESH = %u, CWND = %u\n", &m->daddr, qp->srtt >> 3, qp->ssthresh, qp->cwnd);
+out:
+	spin_unlock_bh(&qn->metrics_lock);
+}
+
+//a connection closes: fold what it learned into the metrics of its destination
+static void quic_update_metrics(struct sock *sk){
+	struct quic_sock *qp = quic_sk(sk);
+	struct quic_net *qn = net_generic(sock_net(sk), quic_net_id);
+	struct quic_metrics *m;
+
+	if(qp->first_rtt || !inet_sk(sk)->inet_daddr)	//nothing learned
+		return;
+	spin_lock_bh(&qn->metrics_lock);
+	m = quic_metrics_get(qn, inet_sk(sk)->inet_daddr, true);
+	if(time_after(jiffies, m->stamp + QUIC_METRICS_TIMEOUT))
+		m->srtt = m->rttvar = m->ssthresh = m->rate = 0;
+	//a smaller RTT is taken at once, a larger one only slowly (1/8 gain)
+	if(!m->srtt || qp->srtt < m->srtt)
+		m->srtt = qp->srtt;
+	else
+		m->srtt += (qp->srtt - m->srtt) >> 3;
+	if(!m->rttvar || qp->rttvar < m->rttvar)
+		m->rttvar = qp->rttvar;
+	else
+		m->rttvar += (qp->rttvar - m->rttvar) >> 3;
+	if(qp->ssthresh != UINT_MAX)
+		m->ssthresh = m->ssthresh ? (m->ssthresh + qp->ssthresh) >> 1 : qp->ssthresh;
+	else if(m->ssthresh && (qp->cwnd >> 1) > m->ssthresh)	//no loss this time and a larger window
+		m->ssthresh = qp->cwnd >> 1;
+	if(qp->rate_max)
+		m->rate = qp->rate_max;
+	m->stamp = jiffies;
+	spin_unlock_bh(&qn->metrics_lock);
+}
+
+//client: remember the 0-RTT token of the server the socket is connected to (0 forgets it)
+static void quic_token_store(struct sock *sk, u32 token){
+	struct inet_sock *inet = inet_sk(sk);
+	struct quic_net *qn = net_generic(sock_net(sk), quic_net_id);
+	struct quic_metrics *m;
+
+	spin_lock_bh(&qn->metrics_lock);
+	m = quic_metrics_get(qn, inet->inet_daddr, token != 0);
+	if(m && token){
+		m->token_port = inet->inet_dport;
+		m->token = token;
+	}else if(m && m->token_port == inet->inet_dport){
+		m->token_port = 0;
+	}
+	spin_unlock_bh(&qn->metrics_lock);
+}
+
+static bool quic_token_lookup(struct sock *sk, u32 *token){
+	struct inet_sock *inet = inet_sk(sk);
+	struct quic_net *qn = net_generic(sock_net(sk), quic_net_id);
+	struct quic_metrics *m;
+	bool found = false;
+
+	if(!qn->sysctl_zero_rtt)
+		return false;
+	spin_lock_bh(&qn->metrics_lock);
+	m = quic_metrics_get(qn, inet->inet_daddr, false);
+	if(m && m->token_port && m->token_port == inet->inet_dport){
+		*token = m->token;
+		found = true;
+	}
+	spin_unlock_bh(&qn->metrics_lock);
+	return found;
+}
+
+// ****   Transport parameters
+// *****************************************************************************************
+/*  The SYN and the SYN reply carry the transport parameters of their sender: how long it delays
+    ACKs, how many bytes it takes in flight, its largest packet and the features it supports.
+    Each side keeps the other's: the PTO allows for the ACK delay of the peer, the data in
+    flight stays within its receive window, and larger packets than it takes are refused. A
+    feature is only used if both sides announced it. A peer that sends no parameters keeps
+    the defaults, which are the behavior from before the parameters existed */
+
+static void quic_tp_default(struct quic_transport_params *tp){
+	tp->max_ack_delay = QUIC_DEL_ACK;
+	tp->rcv_wnd = UINT_MAX;
+	tp->max_pkt = QUIC_MAX_PKT;
+	tp->features = QUIC_TP_FEATURES;
+}
+
+//length of a frame of a SYN or SYN reply, 0 if not one of theirs
+static inline int quic_hs_frame_len(u32 id){
+	switch(id){
+	case TOKEN:
+	case COOKIE:
+		return sizeof(struct token_frame);
+	case ACK:
+		return sizeof(struct ack_frame);
+	case ZRTT_REJECT:
+		return sizeof(__be32);
+	case TRANSPORT_PARAMS:
+		return sizeof(struct tp_frame);
+	}
+	return 0;
+}
+
+//our transport parameters at the end of a SYN or SYN reply
+static void quic_tp_put(struct sock *sk, struct sk_buff *skb){
+	struct quic_sock *qp = quic_sk(sk);
+	struct tp_frame *f = (struct tp_frame *)skb_put(skb, sizeof(struct tp_frame));
+	u16 features = QUIC_TP_FEC | QUIC_TP_MPATH;
+
+	if(qp->ecn_flags & QUIC_ECN_OK)
+		features |= QUIC_TP_ECN;
+	f->id = htonl(TRANSPORT_PARAMS);
+	f->max_ack_delay = htonl(qp->local_tp.max_ack_delay);
+	f->rcv_wnd = htonl(qp->local_tp.rcv_wnd ? qp->local_tp.rcv_wnd : UINT_MAX);
+	f->max_pkt = htons(qp->local_tp.max_pkt);
+	f->features = htons(qp->local_tp.features & features);
+}
+
+//transport parameters among the frames of a SYN or SYN reply from p on
+static bool quic_tp_parse(const struct quichdr *qh, const char *p, struct quic_transport_params *tp){
+	const char *end = (const char *)qh + ntohs(qh->len);
+	const struct tp_frame *f;
+	int flen;
+
+	while(p + sizeof(__be32) <= end){
+		flen = quic_hs_frame_len(ntohl(*(const __be32 *)p));
+		if(!flen || p + flen > end)
+			return false;
+		if(ntohl(*(const __be32 *)p) == TRANSPORT_PARAMS){
+			f = (const struct tp_frame *)p;
+			tp->max_ack_delay = ntohl(f->max_ack_delay);
+			tp->rcv_wnd = ntohl(f->rcv_wnd);
+			tp->max_pkt = ntohs(f->max_pkt);
+			tp->features = ntohs(f->features);
+			return true;
+		}
+		p += flen;
+	}
+	return false;
+}
+
+//the peer's parameters, within bounds that keep the connection going
+static void quic_tp_apply(struct sock *sk, const struct quic_transport_params *tp){
+	struct quic_sock *qp = quic_sk(sk);
+	u16 both = tp->features & qp->local_tp.features;
+
+	qp->peer_tp.max_ack_delay = min_t(u32, tp->max_ack_delay, QUIC_MAX_ACK_DELAY);
+	qp->peer_tp.rcv_wnd = max_t(u32, tp->rcv_wnd, QUIC_MIN_CWND);
+	qp->peer_tp.max_pkt = max_t(u16, tp->max_pkt, QUIC_MSS);
+	qp->peer_tp.features = tp->features;
+	if(!(both & QUIC_TP_ECN) && (qp->ecn_flags & QUIC_ECN_OK)){
+		qp->ecn_flags &= ~QUIC_ECN_OK;
+		INET_ECN_dontxmit(sk);
+	}
+	if(!(both & QUIC_TP_FEC))
+		qp->fec = 0;
+	printk("Peer parameters: max ACK delay %uus, window %u, max packet %u, features %#x\n",
+	       qp->peer_tp.max_ack_delay, qp->peer_tp.rcv_wnd, qp->peer_tp.max_pkt, tp->features);
+}
+
+// ****   Connection ID table
+// *****************************************************************************************
+/*  Established connections are also hashed by connection ID, as a peer that changed its
+    address (new access point, other interface, NAT rebinding) no longer matches the address
+    based lookup of the UDP table. Connection IDs are picked at random by the client, and the
+    local port tells apart the client and server sockets of a connection on the same host */
+
+static struct hlist_head quic_cid_hash[1 << QUIC_CID_HASH_BITS];
+static DEFINE_SPINLOCK(quic_cid_lock);
+
+static void quic_cid_hash_add(struct sock *sk){
+	struct quic_sock *qp = quic_sk(sk);
+
+	spin_lock_bh(&quic_cid_lock);
+	if(hlist_unhashed(&qp->cid_node))
+		hlist_add_head(&qp->cid_node,
+			       &quic_cid_hash[hash_64((__force u64)qp->conn_id, QUIC_CID_HASH_BITS)]);
+	spin_unlock_bh(&quic_cid_lock);
+}
+
+static void quic_cid_hash_del(struct sock *sk){
+	struct quic_sock *qp = quic_sk(sk);
+
+	spin_lock_bh(&quic_cid_lock);
+	if(!hlist_unhashed(&qp->cid_node))
+		hlist_del_init(&qp->cid_node);
+	spin_unlock_bh(&quic_cid_lock);
+}
+
+//established connection of the packet, by connection ID and local port; with a reference
+static struct sock *quic_cid_lookup(struct net *net, const struct quichdr *qh){
+	struct quic_sock *qp;
+	struct sock *found = NULL;
+
+	spin_lock(&quic_cid_lock);
+	hlist_for_each_entry(qp, &quic_cid_hash[hash_64((__force u64)qh->conn_id, QUIC_CID_HASH_BITS)],
+			     cid_node){
+		struct sock *sk = (struct sock *)qp;
+
+		if(qp->conn_id == qh->conn_id && inet_sk(sk)->inet_sport == qh->dest &&
+		   net_eq(sock_net(sk), net) && sk->sk_state == TCP_ESTABLISHED){
+			sock_hold(sk);
+			found = sk;
+			break;
+		}
+	}
+	spin_unlock(&quic_cid_lock);
+	return found;
+}
+
+static inline int quic_sk_init(struct sock *sk)
+{
+	struct quic_sock *qp = quic_sk(sk);
+	struct quic_net *qn = net_generic(sock_net(sk), quic_net_id);
+
+	sk->sk_state = TCP_CLOSE;
+	printk("Set the QUIC socket state to TCP_CLOSE\n");
+	__skb_queue_head_init(&sk->sk_write_queue);
+	__skb_queue_head_init(&sk->quic_receive_queue);
+
+	qp->first_unack = qp->send_next = qp->send_next_sequence = qp->rcv_next = qp->highest_rcv = 0;
+	qp->syn_acked = 0;
+	qp->syn_cookie = 0;
+	qp->zero_rtt = 0;
+	INIT_HLIST_NODE(&qp->cid_node);
+	qp->path_daddr = 0;
+	memset(qp->mpath, 0, sizeof(qp->mpath));
+	qp->mpath_cnt = 0;
+	qp->mpath_sched = QUIC_SCHED_MINRTT;
+	qp->mp_acked_seq = 0;
+	qp->fec = 0;
+	qp->fec_group = QUIC_FEC_MAX_GROUP;
+	qp->fec_cnt = 0;
+	qp->fec_buf = NULL;
+	qp->fec_loss = 0;
+	qp->fec_recovered_acked = 0;
+	qp->fec_rcv = 0;
+	qp->fec_recovered = 0;
+	memset(qp->fec_ring, 0, sizeof(qp->fec_ring));
+	RCU_INIT_POINTER(qp->aead_tx, NULL);
+	RCU_INIT_POINTER(qp->aead_rx, NULL);
+	atomic64_set(&qp->aead_tx_pn, 0);
+	spin_lock_init(&qp->aead_rx_lock);
+	qp->aead_rx_next = 0;
+	memset(qp->aead_rx_seen, 0, sizeof(qp->aead_rx_seen));
+	qp->hs_user = 0;
+	quic_tp_default(&qp->local_tp);		//no receive window: there are no window updates
+	quic_tp_default(&qp->peer_tp);
+	//memset(qp, 0, sizeof(struct quic_sock));
+	//
+	qp->packets_out = 0;
+	qp->bytes_in_flight = 0;
+	qp->nacked_in_q = 0;
+	qp->lost_out = 0;
+	qp->delivered = qp->delivered_time = qp->first_sent_time = 0;
+	qp->app_limited = 0;
+	qp->avg_pkt_len = 0;
+	qp->rate_max = 0;
+	qp->sending = 0;
+	qp->last_sent = NULL;
+	qp->server = 0;
+	
+	//Init the Timers
+	quic_init_xmit_timers(sk);
+	memset(&qp->timer_flags, 0, sizeof(qp->timer_flags));
+
+	qp->ack_flags = 0;
+	INIT_LIST_HEAD(&qp->ack_node);
+
+	//Set the initial RTO to 1s, all RTT values are in us
+	qp->rto = USEC_PER_SEC;
+	qp->srtt = (20 * USEC_PER_MSEC)<<3; //SRTT value is stored in multiple of 8
+	qp->rttvar = 0;
+	qp->mdev = 0;
+	qp->mdev_max = 0;
+	qp->rtt_seq = 0;
+	qp->first_rtt = 1;
+	qp->first_ack = 1;
+	qp->latest_rtt = 0;
+	qp->min_rtt = ~0U;
+	qp->random_loss_time = 0;
+
+	qp->loss_time = 0;
+	qp->pto_count = 0;
+	qp->last_sent_time = 0;
+	qp->recovery_start = 0;
+	qp->prr_target = 0;
+	qp->reordering = quic_reordering_init(qn);
+	qp->reo_wnd = 0;
+	qp->reo_persist = 0;
+	qp->undo_marker = 0;
+
+	//ECT(0) on everything we send until validation fails
+	qp->ecn_flags = 0;
+	memset(qp->ecn_rcv, 0, sizeof(qp->ecn_rcv));
+	qp->ecn_ect_acked = 0;
+	qp->ecn_ect_sent = 0;
+	qp->ecn_ce_acked = 0;
+	if(qn->sysctl_ecn){
+		qp->ecn_flags = QUIC_ECN_OK;
+		INET_ECN_xmit(sk);
+	}
+
+	//Congestion Control************************************************************
+	qp->cwnd = qn->sysctl_init_cwnd * QUIC_MSS;
+	qp->cwnd_cnt = 0;
+	qp->ssthresh = UINT_MAX;
+
+	qp->ca_ops = quic_ca_default(sk);
+
+	printk("Initial RTO = %uus, CWND = %u, SSTHRESH = %u\n", qp->rto, qp->cwnd, qp->ssthresh);
+	
+	return 0;
+
+}
+
+//timers are cleared, queue is emptied, state is changed to "TCP_CLOSE"; only after that, socket is released
+
+static inline void quic_lib_close(struct sock *sk, long timeout)
+{
+	struct quic_sock *qp = quic_sk(sk);
+	struct sk_buff *skb;
+	int i;
+
+
+	if(sk->sk_state == TCP_ESTABLISHED)
+		quic_update_metrics(sk);
+	quic_cid_hash_del(sk);
+	quic_mpath_release(sk);
+	kfree(qp->fec_buf);
+	qp->fec_buf = NULL;
+	for(i = 0; i < QUIC_FEC_RING; i++){
+		kfree(qp->fec_ring[i]);
+		qp->fec_ring[i] = NULL;
+	}
+	quic_aead_release(sk);
+	quic_clear_loss_detection_timer(sk);
+	quic_clear_del_ack_timer(sk);
+	quic_stop_xmit_timers(sk);
+	quic_cleanup_congestion_control(sk);
+
+	while(!skb_queue_empty(&sk->sk_write_queue)){
+		skb = skb_peek(&sk->sk_write_queue);
+		skb_unlink(skb, &sk->sk_write_queue);
+		kfree_skb(skb);
+	}
+	printk("Emptied the send queue....");
+	sk->sk_state = TCP_CLOSE;
+	printk("Closing socket.........\n");
 
         sk_common_release(sk);
 }
@@ -995,8 +2514,8 @@ struct proto 	quic_prot = {
 	.ioctl		   = udp_ioctl,
 	.init		   = quic_sk_init,
 	.destroy	   = udp_destroy_sock,
-	.setsockopt	   = udp_setsockopt,
-	.getsockopt	   = udp_getsockopt,
+	.setsockopt	   = quic_setsockopt,
+	.getsockopt	   = quic_getsockopt,
 	.sendmsg	   = quic_sendmsg,
 	.recvmsg	   = quic_recvmsg,
 	//.sendpage	   = quic_sendpage,
@@ -1026,77 +2545,755 @@ static struct inet_protosw quic4_protosw = {
 	.flags		=  INET_PROTOSW_PERMANENT,                  //behavior cannot be overridden
 };
 
-#ifdef CONFIG_PROC_FS
-/* important kernel data structure; needed for char driver to set up a connection */
-static const struct file_operations quic_afinfo_seq_fops = {
-	.owner    = THIS_MODULE,        //module that owns the structure (here: default value)
-	.open     = udp_seq_open,       //first operation performed (not always required!) 
-	.read     = seq_read,           //retrieve data
-	.llseek   = seq_lseek,          //change current read/write position in a file
-	.release  = seq_release_net     //invoked when the file structure is being released
-};
+#ifdef CONFIG_PROC_FS
+/* important kernel data structure; needed for char driver to set up a connection */
+static const struct file_operations quic_afinfo_seq_fops = {
+	.owner    = THIS_MODULE,        //module that owns the structure (here: default value)
+	.open     = udp_seq_open,       //first operation performed (not always required!) 
+	.read     = seq_read,           //retrieve data
+	.llseek   = seq_lseek,          //change current read/write position in a file
+	.release  = seq_release_net     //invoked when the file structure is being released
+};
+
+static struct udp_seq_afinfo quic4_seq_afinfo = {
+	.name		= "quic",
+	.family		= AF_INET,
+	.udp_table 	= &quic_table,              //QUIC runs on top of UDP - tables are the same
+	.seq_fops	= &quic_afinfo_seq_fops,    //file operations already defined in the prev struct
+	.seq_ops	= {
+		.show		= udp4_seq_show,        //further operations
+	},
+};
+
+static int __net_init quic4_proc_init_net(struct net *net)
+{
+	return udp_proc_register(net, &quic4_seq_afinfo);
+}
+
+static void __net_exit quic4_proc_exit_net(struct net *net)
+{
+	udp_proc_unregister(net, &quic4_seq_afinfo);
+}
+/* added for network namespaces specific data - init and exit for device/subsystem specific initialization and cleanup   */
+static struct pernet_operations quic4_net_ops = {
+	.init = quic4_proc_init_net,
+	.exit = quic4_proc_exit_net,
+};
+//if it hasn't already been done - this function registers QUIC protocol with the network subsystem!
+static __init int quic4_proc_init(void)
+{
+	return register_pernet_subsys(&quic4_net_ops);
+}
+#else
+static inline int quic4_proc_init(void)
+{
+	return 0;
+}
+#endif
+static void __init quic_ack_batch_init(void);
+
+/* annotations like __init have no effect for normal computations - these macros are used to mark some initialized data as "initialization" functions, which means the kernel can free up memory resources afterwards */
+void __init quic4_register(void)    
+{
+	BUILD_BUG_ON(sizeof(struct quic_skb_cb) > FIELD_SIZEOF(struct sk_buff, cb));
+
+    //initializing UDP table
+	udp_table_init(&quic_table, "QUIC");
+	quic_ack_batch_init();                          //per-CPU ACK aggregation lists
+	if (register_pernet_subsys(&quic_net_ops))       //per-namespace default congestion control
+		goto out_register_err;
+	if (quic_cubic_register())                      //built-in congestion control
+		goto out_unregister_net;
+	if (quic_ledbat_register())
+		goto out_unregister_cubic;
+	if (proto_register(&quic_prot, 1))              //register to Linux network subsystem
+		goto out_unregister_ledbat;
+	printk("<7>\n Registered QUIC protocol\n");
+
+	if (inet_add_protocol(&quic_protocol, IPPROTO_QUIC) < 0)    //protocol registers itself to net
+		goto out_unregister_proto;
+	printk("<7>\n added QUIC protocol to net\n");
+
+	inet_register_protosw(&quic4_protosw); 
+
+	if (quic4_proc_init())  //registers protocol within the network subsystem
+		pr_err("%s: Cannot register /proc!\n", __func__);
+	return;
+//unnecessary gotos?
+out_unregister_proto:
+	proto_unregister(&quic_prot);                               //protocol has to unregister from Linux network subsystem if registration to protocol table fails!
+out_unregister_ledbat:
+	quic_unregister_congestion_control(&quic_ledbat);
+out_unregister_cubic:
+	quic_unregister_congestion_control(&quic_cubic);
+out_unregister_net:
+	unregister_pernet_subsys(&quic_net_ops);
+out_register_err:
+	pr_crit("%s: Can't add QUIC protocol\n", __func__);
+}
+
+// ****   Delivery rate sampling
+// *****************************************************************************************
+/*  As TCP's tcp_rate.c: every packet remembers how much had been delivered, and when, at the
+    time it was sent. When it is ACKed, the delivery rate over that interval is
+    delivered / max(send interval, ACK interval). The ACK interval alone would overestimate the
+    rate after ACK compression, the send interval alone after a burst was sent */
+
+//snapshot of the connection's delivery state for a packet being (re)sent
+static void quic_rate_skb_sent(struct sock *sk, struct quic_skb_cb *qb)
+{
+	struct quic_sock *qp = quic_sk(sk);
+
+	//first packet of a flight: start the send and ACK intervals now
+	if (!qp->packets_out) {
+		qp->first_sent_time = qb->timestamp;
+		qp->delivered_time = qb->timestamp;
+	}
+
+	qb->send_elapsed = min_t(u32, (qb->timestamp - qp->first_sent_time) / QUIC_RATE_ELAPSED_US, USHRT_MAX);
+	qb->delivered_time = qp->delivered_time;
+	qb->delivered = qp->delivered;
+	if (qp->app_limited)
+		qb->flags |= QUIC_PKT_APP_LIMITED;
+	else
+		qb->flags &= ~QUIC_PKT_APP_LIMITED;
+}
+
+//a packet is ACKed: the most recently sent of the ACKed packets gives the rate sample
+static void quic_rate_skb_delivered(struct sock *sk, struct sk_buff *skb,
+				    struct quic_ack_sample *rs)
+{
+	struct quic_sock *qp = quic_sk(sk);
+	struct quic_skb_cb *qb = QUIC_SKB_CB(skb);
+
+	qp->delivered++;
+
+	if (!rs->prior_valid || after(qb->delivered, rs->prior_delivered)) {
+		rs->prior_valid = 1;
+		rs->prior_delivered = qb->delivered;
+		rs->prior_time = qb->delivered_time;
+		rs->is_app_limited = !!(qb->flags & QUIC_PKT_APP_LIMITED);
+		rs->send_elapsed = qb->send_elapsed * QUIC_RATE_ELAPSED_US;
+
+		//the next flight starts with the send time of this packet
+		qp->first_sent_time = qb->timestamp;
+	}
+}
+
+//rate sample of one ACK, once all its packets have been seen
+static void quic_rate_gen(struct sock *sk, struct quic_ack_sample *rs)
+{
+	struct quic_sock *qp = quic_sk(sk);
+	u32 now = QUIC_TIMESTAMP;
+	u32 ack_elapsed;
+
+	//the application limited stretch ends once its packets are delivered
+	if (qp->app_limited && after(qp->delivered, qp->app_limited))
+		qp->app_limited = 0;
+
+	if (rs->acked)
+		qp->delivered_time = now;
+
+	if (!rs->prior_valid) {
+		rs->delivered = 0;
+		rs->interval_us = -1;
+		return;
+	}
+	rs->delivered = qp->delivered - rs->prior_delivered;
+
+	ack_elapsed = now - rs->prior_time;
+	rs->ack_elapsed = ack_elapsed;
+	rs->interval_us = max(rs->send_elapsed, ack_elapsed);
+
+	//shorter than the minimum RTT: the sample can only be wrong
+	if (qp->min_rtt != ~0U && rs->interval_us < (s32)qp->min_rtt) {
+		rs->interval_us = -1;
+		return;
+	}
+
+	//the largest rate the path delivered, kept in the metrics cache
+	if (!rs->is_app_limited && rs->interval_us > 0 && rs->delivered)
+		qp->rate_max = max_t(u64, qp->rate_max,
+				     min_t(u64, div_u64((u64)rs->delivered * qp->avg_pkt_len * USEC_PER_SEC,
+							rs->interval_us), ~0U));
+}
+
+//nothing left to send while cwnd has room: the following samples are application limited
+static void quic_rate_check_app_limited(struct sock *sk)
+{
+	struct quic_sock *qp = quic_sk(sk);
+
+	if (qp->bytes_in_flight < qp->cwnd && !qp->lost_out)
+		qp->app_limited = (qp->delivered + qp->packets_out) ? : 1;
+}
+
+/* final function which does the actual packet transmission, cloning the packet before sending to maintain a copy of them for retransmission, if necessary */
+// ****   Packet protection
+// *****************************************************************************************
+/*  AEAD (AES-GCM, and ChaCha20-Poly1305 where the kernel has it) through the kernel crypto API,
+    with keys installed from user space with the QUIC_CRYPTO socket option. Once there are keys,
+    every packet but SYN, SYN_REP and RETRY has the prot bit set and its payload encrypted, the
+    header from the connection ID on is authenticated. The nonce is the IV XORed with a 64 bit
+    packet counter, which follows the tag in clear since the sequence field is not unique per
+    packet (ACKs). Transforms are per connection as keys are, the request and scatterlists are
+    per CPU. Sending reads the plaintext where it is in the queued packet, frags included, which
+    stays in clear for retransmissions, and writes the ciphertext straight into the one packet
+    allocated to go out; the queued packet is not cloned. Received packets are decrypted in place.
+    Only synchronous algorithms, packets are protected in softirq context too */
+
+struct quic_aead_scratch {
+	struct scatterlist	src[QUIC_AEAD_MAX_SG];
+	struct scatterlist	dst;
+	struct scatterlist	assoc;
+	u8			iv[QUIC_AEAD_IV_LEN];
+	u8			req[QUIC_AEAD_REQ_SIZE] __aligned(CRYPTO_MINALIGN);
+};
+static DEFINE_PER_CPU(struct quic_aead_scratch, quic_aead_scratch);
+
+//authenticated header from the flags on: ports, length and checksum may differ on the way or
+//are known only later
+#define QUIC_AAD_OFFSET		(offsetof(struct quichdr, check) + sizeof(__sum16))
+#define QUIC_AAD_LEN		(sizeof(struct quichdr) - QUIC_AAD_OFFSET)
+
+static inline bool quic_is_handshake(const struct quichdr *qh){
+	u32 type = ntohl(qh->type);
+
+	return type == SYN || type == SYN_REP || type == RETRY;
+}
+
+static struct quic_aead *quic_aead_alloc(const char *name, const u8 *key, unsigned int keylen,
+					 const u8 *iv){
+	struct quic_aead *a;
+	int err;
+
+	a = kmalloc(sizeof(*a), GFP_KERNEL);
+	if(!a)
+		return ERR_PTR(-ENOMEM);
+	a->tfm = crypto_alloc_aead(name, 0, CRYPTO_ALG_ASYNC);
+	if(IS_ERR(a->tfm)){
+		err = PTR_ERR(a->tfm);
+		goto out_free;
+	}
+	err = -EINVAL;
+	if(crypto_aead_ivsize(a->tfm) != QUIC_AEAD_IV_LEN ||
+	   sizeof(struct aead_request) + crypto_aead_reqsize(a->tfm) > QUIC_AEAD_REQ_SIZE)
+		goto out_tfm;
+	err = crypto_aead_setkey(a->tfm, key, keylen);
+	if(!err)
+		err = crypto_aead_setauthsize(a->tfm, QUIC_AEAD_TAG_LEN);
+	if(err)
+		goto out_tfm;
+	memcpy(a->iv, iv, QUIC_AEAD_IV_LEN);
+	return a;
+
+out_tfm:
+	crypto_free_aead(a->tfm);
+out_free:
+	kfree(a);
+	return ERR_PTR(err);
+}
+
+static void quic_aead_free(struct quic_aead *a){
+	if(!a)
+		return;
+	crypto_free_aead(a->tfm);
+	kzfree(a);
+}
+
+//install new keys; packets being protected with the old ones are waited for
+static int quic_set_crypto(struct sock *sk, const struct quic_crypto_info *info){
+	struct quic_sock *qp = quic_sk(sk);
+	struct quic_aead *tx, *rx, *old_tx, *old_rx;
+	const char *name;
+	unsigned int keylen;
+
+	switch(info->cipher){
+	case QUIC_CIPHER_AES_GCM_128:
+		name = "gcm(aes)";
+		keylen = 16;
+		break;
+	case QUIC_CIPHER_AES_GCM_256:
+		name = "gcm(aes)";
+		keylen = 32;
+		break;
+	case QUIC_CIPHER_CHACHA20_POLY1305:
+		name = "rfc7539(chacha20,poly1305)";
+		keylen = 32;
+		break;
+	default:
+		return -EINVAL;
+	}
+	tx = quic_aead_alloc(name, info->tx_key, keylen, info->tx_iv);
+	if(IS_ERR(tx))
+		return PTR_ERR(tx);
+	rx = quic_aead_alloc(name, info->rx_key, keylen, info->rx_iv);
+	if(IS_ERR(rx)){
+		quic_aead_free(tx);
+		return PTR_ERR(rx);
+	}
+
+	old_tx = rcu_dereference_protected(qp->aead_tx, sock_owned_by_user(sk));
+	old_rx = rcu_dereference_protected(qp->aead_rx, sock_owned_by_user(sk));
+	rcu_assign_pointer(qp->aead_tx, tx);
+	rcu_assign_pointer(qp->aead_rx, rx);
+	if(old_tx || old_rx){
+		synchronize_net();
+		quic_aead_free(old_tx);
+		quic_aead_free(old_rx);
+	}
+	printk("Packet protection keys installed, cipher %u\n", info->cipher);
+	return 0;
+}
+
+static void quic_aead_release(struct sock *sk){
+	struct quic_sock *qp = quic_sk(sk);
+	struct quic_aead *tx = rcu_dereference_protected(qp->aead_tx, 1);
+	struct quic_aead *rx = rcu_dereference_protected(qp->aead_rx, 1);
+
+	if(!tx && !rx)
+		return;
+	RCU_INIT_POINTER(qp->aead_tx, NULL);
+	RCU_INIT_POINTER(qp->aead_rx, NULL);
+	synchronize_net();
+	quic_aead_free(tx);
+	quic_aead_free(rx);
+}
+
+/*  Encrypts (enc) or decrypts the cryptlen bytes of src into dst for the packet counter pn, the
+    tag follows the ciphertext. Called with BHs disabled, for the per CPU scratch */
+static int quic_aead_crypt(const struct quic_aead *key, struct quic_aead_scratch *s,
+			   const struct quichdr *qh, struct scatterlist *src, struct scatterlist *dst,
+			   unsigned int cryptlen, u64 pn, bool enc){
+	struct aead_request *req = (struct aead_request *)s->req;
+	u8 npn[sizeof(__be64)];
+	int i;
+
+	put_unaligned_be64(pn, npn);
+	memcpy(s->iv, key->iv, QUIC_AEAD_IV_LEN);
+	for(i = 0; i < sizeof(npn); i++)
+		s->iv[QUIC_AEAD_IV_LEN - sizeof(npn) + i] ^= npn[i];
+	sg_init_one(&s->assoc, (const u8 *)qh + QUIC_AAD_OFFSET, QUIC_AAD_LEN);
+
+	aead_request_set_tfm(req, key->tfm);
+	aead_request_set_callback(req, 0, NULL, NULL);
+	aead_request_set_assoc(req, &s->assoc, QUIC_AAD_LEN);
+	aead_request_set_crypt(req, src, dst, cryptlen, s->iv);
+	return enc ? crypto_aead_encrypt(req) : crypto_aead_decrypt(req);
+}
+
+/*  Protects the payload of plen bytes following qh, in a linear buffer with QUIC_AEAD_OVERHEAD
+    bytes of room after it. Returns the bytes added, 0 if there are no keys */
+static int quic_aead_seal(struct sock *sk, struct quichdr *qh, int plen){
+	struct quic_sock *qp = quic_sk(sk);
+	struct quic_aead_scratch *s;
+	struct quic_aead *key;
+	u8 *payload = (u8 *)(qh + 1);
+	u64 pn;
+	int err = 0;
+
+	local_bh_disable();
+	rcu_read_lock();
+	key = rcu_dereference(qp->aead_tx);
+	if(key && !quic_is_handshake(qh)){
+		pn = atomic64_inc_return(&qp->aead_tx_pn) - 1;
+		qh->prot = 1;
+		put_unaligned_be64(pn, payload + plen + QUIC_AEAD_TAG_LEN);
+		s = this_cpu_ptr(&quic_aead_scratch);
+		sg_init_one(&s->dst, payload, plen + QUIC_AEAD_TAG_LEN);
+		err = quic_aead_crypt(key, s, qh, &s->dst, &s->dst, plen, pn, 1);
+		if(!err)
+			err = QUIC_AEAD_OVERHEAD;
+	}
+	rcu_read_unlock();
+	local_bh_enable();
+	return err;
+}
+
+/*  Packet that goes out for a protected packet: the IP and QUIC headers of skb, copied, and
+    room for the ciphertext and the overhead, filled by quic_aead_encrypt() */
+static struct sk_buff *quic_aead_skb(struct sock *sk, struct sk_buff *skb){
+	struct sk_buff *nskb;
+	int off = skb_transport_offset(skb) + sizeof(struct quichdr);
+
+	nskb = alloc_skb(MAX_HEADER + skb->len + QUIC_AEAD_OVERHEAD, GFP_ATOMIC);
+	if(!nskb)
+		return NULL;
+	skb_reserve(nskb, MAX_HEADER);
+	skb_put(nskb, skb->len + QUIC_AEAD_OVERHEAD);
+	skb_copy_bits(skb, 0, nskb->data, off);		//IP and QUIC headers
+	skb_reset_network_header(nskb);
+	skb_set_transport_header(nskb, skb_transport_offset(skb));
+	memcpy(nskb->cb, skb->cb, sizeof(skb->cb));
+	nskb->priority = skb->priority;
+	nskb->mark = skb->mark;
+	skb_dst_set(nskb, dst_clone(skb_dst(skb)));
+	skb_set_owner_w(nskb, sk);
+	return nskb;
+}
+
+/*  Protects a packet about to be sent: encrypts the payload of skb, which stays in clear, into
+    nskb from quic_aead_skb() whose QUIC header is final */
+static int quic_aead_encrypt(struct sock *sk, struct sk_buff *nskb, struct sk_buff *skb){
+	struct quic_sock *qp = quic_sk(sk);
+	struct quic_aead_scratch *s;
+	struct quic_aead *key;
+	int off = skb_transport_offset(skb) + sizeof(struct quichdr);
+	int plen = skb->len - off;
+	u64 pn;
+	int err;
+
+	if((skb_shinfo(skb)->nr_frags + 1 > QUIC_AEAD_MAX_SG || skb_has_frag_list(skb)) &&
+	   skb_linearize(skb))
+		return -ENOMEM;
+
+	pn = atomic64_inc_return(&qp->aead_tx_pn) - 1;
+	quic_hdr(nskb)->prot = 1;
+	put_unaligned_be64(pn, skb_transport_header(nskb) + sizeof(struct quichdr) + plen + QUIC_AEAD_TAG_LEN);
+
+	local_bh_disable();
+	rcu_read_lock();
+	key = rcu_dereference(qp->aead_tx);
+	err = -ENOKEY;
+	if(key){
+		s = this_cpu_ptr(&quic_aead_scratch);
+		sg_init_one(&s->dst, skb_transport_header(nskb) + sizeof(struct quichdr),
+			    plen + QUIC_AEAD_TAG_LEN);
+		if(plen){
+			sg_init_table(s->src, skb_shinfo(skb)->nr_frags + 1);
+			skb_to_sgvec(skb, s->src, off, plen);
+		}
+		err = quic_aead_crypt(key, s, quic_hdr(nskb), plen ? s->src : &s->dst, &s->dst,
+				      plen, pn, 1);
+	}
+	rcu_read_unlock();
+	local_bh_enable();
+	return err;
+}
+
+/*  Replay window of the packet counters received, once the packet proved authentic: a counter
+    seen before, or more than QUIC_REPLAY_WINDOW behind the highest one, is refused. Every
+    transmission, ACKs and retransmissions included, takes a new counter, so the window covers
+    the reordering the loss detection accepts (net.quic.max_reordering, bounded accordingly) on
+    each of the paths at once. The bitmap is circular, as WireGuard's: moving ahead clears the
+    words passed over, the word of the highest counter keeps the bits just below it */
+static bool quic_aead_replayed(struct quic_sock *qp, u64 pn){
+	u64 n = pn + 1;		//0 is the empty window
+	u64 word, cur, i, top, bit;
+	bool seen = 1;
+
+	spin_lock_bh(&qp->aead_rx_lock);
+	if(n + QUIC_REPLAY_WINDOW < qp->aead_rx_next)
+		goto out;	//too old
+	word = n >> 6;
+	if(n > qp->aead_rx_next){
+		cur = qp->aead_rx_next >> 6;
+		top = min_t(u64, word - cur, QUIC_REPLAY_WORDS);
+		for(i = 1; i <= top; i++)
+			qp->aead_rx_seen[(cur + i) & (QUIC_REPLAY_WORDS - 1)] = 0;
+		qp->aead_rx_next = n;
+	}
+	word &= QUIC_REPLAY_WORDS - 1;
+	bit = 1ULL << (n & 63);
+	seen = (qp->aead_rx_seen[word] & bit) != 0;
+	qp->aead_rx_seen[word] |= bit;
+out:
+	spin_unlock_bh(&qp->aead_rx_lock);
+	return seen;
+}
+
+/*  Received packet: decrypted in place once the checksum over the ciphertext is verified, and
+    dropped if its packet counter was seen before. A packet in clear is only accepted before
+    there are keys, and for the handshake */
+static int quic_aead_decrypt(struct sock *sk, struct sk_buff *skb){
+	struct quic_sock *qp = quic_sk(sk);
+	struct quichdr *qh = quic_hdr(skb);
+	struct quic_aead_scratch *s;
+	struct quic_aead *key;
+	struct sk_buff *trailer;
+	int off = skb_transport_offset(skb) + sizeof(struct quichdr);
+	int clen = skb->len - off - sizeof(__be64);	//ciphertext and tag
+	u8 npn[sizeof(__be64)];
+	int nsg, err;
+
+	if(!qh->prot)
+		return rcu_access_pointer(qp->aead_rx) && !quic_is_handshake(qh) ? -EBADMSG : 0;
+	if(clen < QUIC_AEAD_TAG_LEN || skb_copy_bits(skb, skb->len - sizeof(npn), npn, sizeof(npn)))
+		return -EBADMSG;
+	if(quic_lib_checksum_complete(skb))
+		return -EINVAL;
+	nsg = skb_cow_data(skb, 0, &trailer);
+	if(nsg < 0)
+		return nsg;
+	if(nsg > QUIC_AEAD_MAX_SG)
+		return -EMSGSIZE;
+	qh = quic_hdr(skb);		//the head may have moved
+
+	local_bh_disable();
+	rcu_read_lock();
+	key = rcu_dereference(qp->aead_rx);
+	err = -ENOKEY;
+	if(key){
+		s = this_cpu_ptr(&quic_aead_scratch);
+		sg_init_table(s->src, nsg);
+		skb_to_sgvec(skb, s->src, off, clen);
+		err = quic_aead_crypt(key, s, qh, s->src, s->src, clen, get_unaligned_be64(npn), 0);
+	}
+	rcu_read_unlock();
+	local_bh_enable();
+	if(err)
+		return err;
+	if(quic_aead_replayed(qp, get_unaligned_be64(npn))){
+		printk("QUIC: replayed packet counter %llu dropped\n", get_unaligned_be64(npn));
+		return -EBADMSG;
+	}
+	if(pskb_trim(skb, skb->len - QUIC_AEAD_OVERHEAD))
+		return -ENOMEM;
+	qh->len = htons(skb->len - skb_transport_offset(skb));
+	skb->ip_summed = CHECKSUM_UNNECESSARY;
+	return 0;
+}
+
+// ****   Forward error correction
+// *****************************************************************************************
+/*  On lossy links a lost packet otherwise costs at least a round trip (NACK or timer). With the
+    QUIC_FEC socket option the sender XORs the payloads of consecutive new data packets and queues
+    one repair packet behind each group, and also when it runs out of data so the tail of a burst
+    is protected. Repair packets take a packet number and are sent, paced, counted in flight,
+    acknowledged and retransmitted like data packets; the receiver does not deliver them, and
+    does not wait for a lost one: the data packet queued behind a repair packet says so in its
+    (authenticated) header, and once it is next in line the repair packet's number is skipped, its
+    group having been delivered already. The receiver keeps copies of the payloads of the data
+    packets it got lately and rebuilds a single missing packet of a group from the repair packet;
+    while the peer sends repair packets, an out of order packet does not trigger an immediate ACK
+    so the gap is not NACKed before the repair packet had a chance. The receiver reports how many
+    packets it rebuilt in its ACKs, so the sender measures the loss rate before repair and makes
+    groups of about 1/(4 * loss rate) packets, in which two losses are unlikely */
+
+//XOR len bytes of the skb from offset into buf
+static void quic_fec_xor(u8 *buf, const struct sk_buff *skb, int offset, int len){
+	u8 chunk[64];
+	int i, n;
+
+	while(len > 0){
+		n = min_t(int, len, sizeof(chunk));
+		if(skb_copy_bits(skb, offset, chunk, n))
+			return;
+		for(i = 0; i < n; i++)
+			buf[i] ^= chunk[i];
+		buf += n;
+		offset += n;
+		len -= n;
+	}
+}
+
+//queue the repair packet of the current group behind it, returns whether one was queued
+static bool quic_fec_send(struct sock *sk){
+	struct quic_sock *qp = quic_sk(sk);
+	struct inet_sock *inet = inet_sk(sk);
+	struct flowi4 *fl4 = &inet->cork.fl.u.ip4;
+	struct fec_hdr *fh = (struct fec_hdr *)qp->fec_buf;
+	struct quic_skb_cb *qb;
+	struct sk_buff *skb;
+	int len;
 
-static struct udp_seq_afinfo quic4_seq_afinfo = {
-	.name		= "quic",
-	.family		= AF_INET,
-	.udp_table 	= &quic_table,              //QUIC runs on top of UDP - tables are the same
-	.seq_fops	= &quic_afinfo_seq_fops,    //file operations already defined in the prev struct
-	.seq_ops	= {
-		.show		= udp4_seq_show,        //further operations
-	},
-};
+	if(!qp->fec_cnt)
+		return 0;
+	fh->offset = htonl(qp->fec_first);
+	fh->count = htons(qp->fec_cnt);
+	fh->len = htons(qp->fec_len);
+	fh->seq = 0;		//known when it is first sent, see quic_fec_seq()
+	fh->seq_mask = 0;
+	fh->unused = 0;
+	len = sizeof(*fh) + qp->fec_max_len;
+	qp->fec_cnt = 0;
+
+	skb = quic_ip_make_skb(sk, fl4, len);
+	if(IS_ERR_OR_NULL(skb))
+		return 0;
+	qb = QUIC_SKB_CB(skb);
+	memset(qb, 0, sizeof(struct quic_skb_cb));
+	qb->offset = qp->send_next++;
+	quic_hdr(skb)->type = htonl(FEC);
+	memcpy(skb_put(skb, len), fh, len);
+	skb_queue_tail(&sk->sk_write_queue, skb);
+	return 1;
+}
 
-static int __net_init quic4_proc_init_net(struct net *net)
-{
-	return udp_proc_register(net, &quic4_seq_afinfo);
+/*  First transmission of a repair packet: XOR the sequence numbers its members went out with
+    (their latest transmission), so the receiver can give a rebuilt packet its real sequence
+    number and the ACK that covers it yields an RTT sample. Members already acknowledged and
+    removed from the queue are left out of seq_mask. The packet has not been cloned yet */
+static void quic_fec_seq(struct sock *sk, struct sk_buff *skb){
+	struct fec_hdr *fh = (struct fec_hdr *)(skb_transport_header(skb) + sizeof(struct quichdr));
+	u32 first = ntohl(fh->offset), n = ntohs(fh->count);
+	u32 seq = 0;
+	u16 mask = 0;
+	struct sk_buff *m;
+
+	for(m = skb->prev; m != (struct sk_buff *)&sk->sk_write_queue; m = m->prev){
+		struct quic_skb_cb *mb = QUIC_SKB_CB(m);
+
+		if(before(mb->offset, first))
+			break;
+		if(mb->offset - first < n && ntohl(quic_hdr(m)->type) == DATA){
+			seq ^= mb->sequence;
+			mask |= 1 << (mb->offset - first);
+		}
+	}
+	fh->seq = htonl(seq);
+	fh->seq_mask = htons(mask);
 }
 
-static void __net_exit quic4_proc_exit_net(struct net *net)
-{
-	udp_proc_unregister(net, &quic4_seq_afinfo);
+//a new data packet is queued: XOR it into the group, which needs consecutive packets; a full
+//group gets its repair packet queued behind it
+static void quic_fec_add(struct sock *sk, struct sk_buff *skb){
+	struct quic_sock *qp = quic_sk(sk);
+	struct quic_skb_cb *qb = QUIC_SKB_CB(skb);
+	u8 *xor = qp->fec_buf + sizeof(struct fec_hdr);
+	int off = skb_transport_offset(skb) + sizeof(struct quichdr);
+	int len = skb->len - off;
+
+	if(qp->fec_cnt && qb->offset != qp->fec_first + qp->fec_cnt)
+		quic_fec_send(sk);
+	if(len > QUIC_FEC_MAX_PAYLOAD)
+		return;
+	if(!qp->fec_cnt){
+		qp->fec_first = qb->offset;
+		qp->fec_len = 0;
+		qp->fec_max_len = 0;
+	}
+	if(len > qp->fec_max_len){
+		memset(xor + qp->fec_max_len, 0, len - qp->fec_max_len);
+		qp->fec_max_len = len;
+	}
+	quic_fec_xor(xor, skb, off, len);
+	qp->fec_len ^= len;
+	qp->fec_cnt++;
+	if(qp->fec_cnt >= qp->fec_group)
+		quic_fec_send(sk);
 }
-/* added for network namespaces specific data - init and exit for device/subsystem specific initialization and cleanup   */
-static struct pernet_operations quic4_net_ops = {
-	.init = quic4_proc_init_net,
-	.exit = quic4_proc_exit_net,
-};
-//if it hasn't already been done - this function registers QUIC protocol with the network subsystem!
-static __init int quic4_proc_init(void)
-{
-	return register_pernet_subsys(&quic4_net_ops);
+
+//loss rate of an ACK, rebuilt packets count as lost; the group size follows it
+static void quic_fec_adapt(struct sock *sk, const struct quic_ack_sample *rs, u32 recovered){
+	struct quic_sock *qp = quic_sk(sk);
+	u32 lost = rs->lost + recovered;
+	u32 n = rs->acked + rs->mp_acked + rs->lost;
+
+	if(!n)
+		return;
+	lost = min(lost, n);
+	qp->fec_loss = qp->fec_loss - (qp->fec_loss >> 3) +
+		       (((lost << QUIC_FEC_LOSS_SHIFT) / n) >> 3);
+	qp->fec_group = qp->fec_loss ?
+		clamp_t(u32, (1U << QUIC_FEC_LOSS_SHIFT) / (4 * qp->fec_loss),
+			QUIC_FEC_MIN_GROUP, QUIC_FEC_MAX_GROUP) : QUIC_FEC_MAX_GROUP;
 }
-#else
-static inline int quic4_proc_init(void)
-{
-	return 0;
+
+//receiver: copy the payload of a data packet for the repair packet of its group, larger packets
+//are not protected
+static void quic_fec_rcv(struct quic_sock *qp, struct sk_buff *skb){
+	const struct quichdr *qh = quic_hdr(skb);
+	struct quic_fec_slot **slot = &qp->fec_ring[qh->offset % QUIC_FEC_RING];
+	int off = skb_transport_offset(skb) + sizeof(struct quichdr);
+	int len = skb->len - off;
+
+	if(len > QUIC_FEC_MAX_PAYLOAD)
+		return;
+	if(!*slot){
+		*slot = kmalloc(sizeof(**slot), GFP_ATOMIC);
+		if(!*slot)
+			return;
+	}
+	if(skb_copy_bits(skb, off, (*slot)->data, len)){
+		kfree(*slot);
+		*slot = NULL;
+		return;
+	}
+	(*slot)->offset = qh->offset;
+	(*slot)->sequence = qh->sequence;
+	(*slot)->len = len;
 }
-#endif
-/* annotations like __init have no effect for normal computations - these macros are used to mark some initialized data as "initialization" functions, which means the kernel can free up memory resources afterwards */
-void __init quic4_register(void)    
-{
-    //initializing UDP table
-	udp_table_init(&quic_table, "QUIC");
-	if (proto_register(&quic_prot, 1))              //register to Linux network subsystem
-		goto out_register_err;
-	printk("<7>\n Registered QUIC protocol\n");
 
-	if (inet_add_protocol(&quic_protocol, IPPROTO_QUIC) < 0)    //protocol registers itself to net
-		goto out_unregister_proto;
-	printk("<7>\n added QUIC protocol to net\n");
+static struct quic_fec_slot *quic_fec_find(struct quic_sock *qp, __be32 offset){
+	struct quic_fec_slot *slot = qp->fec_ring[offset % QUIC_FEC_RING];
 
-	inet_register_protosw(&quic4_protosw); 
+	return slot && slot->offset == offset ? slot : NULL;
+}
 
-	if (quic4_proc_init())  //registers protocol within the network subsystem
-		pr_err("%s: Cannot register /proc!\n", __func__);
-	return;
-//unnecessary gotos?
-out_unregister_proto:
-	proto_unregister(&quic_prot);                               //protocol has to unregister from Linux network subsystem if registration to protocol table fails!
-out_register_err:
-	pr_crit("%s: Can't add QUIC protocol\n", __func__);
+/*  Repair packet received: if exactly one data packet of its group is missing, rebuild it as a
+    copy of the repair packet with the XOR of the other payloads taken out, and with the packet
+    number and the sequence number it was sent with. Returns the rebuilt packet, to be received as
+    a data packet, or NULL */
+static struct sk_buff *quic_fec_recover(struct sock *sk, struct sk_buff *skb){
+	struct quic_sock *qp = quic_sk(sk);
+	struct quic_fec_slot *other;
+	struct sk_buff *nskb;
+	struct quichdr *nqh;
+	struct fec_hdr fh;
+	__be32 first, missing = 0;
+	u32 seq;
+	u16 mask;
+	int i, j, n, lost = 0, plen, len;
+	int hoff = skb_transport_offset(skb) + sizeof(struct quichdr);
+	u8 *buf;
+
+	qp->fec_rcv = 1;
+	if(skb_copy_bits(skb, hoff, &fh, sizeof(fh)))
+		return NULL;
+	first = ntohl(fh.offset);
+	n = ntohs(fh.count);
+	plen = skb->len - hoff - sizeof(fh);
+	if(!n || n > QUIC_FEC_MAX_GROUP || plen < 0)
+		return NULL;
+	for(i = 0; i < n; i++){
+		if(!quic_fec_find(qp, first + i)){
+			missing = first + i;
+			lost++;
+		}
+	}
+	//nothing to rebuild, or too much
+	if(lost != 1 || before(missing, qp->rcv_next) || is_in_rcv_q(sk, missing))
+		return NULL;
+
+	nskb = skb_copy(skb, GFP_ATOMIC);
+	if(!nskb)
+		return NULL;
+	buf = skb_transport_header(nskb) + sizeof(struct quichdr);
+	memmove(buf, buf + sizeof(fh), plen);
+	len = ntohs(fh.len);
+	seq = ntohl(fh.seq);
+	mask = ntohs(fh.seq_mask);
+	for(i = 0; i < n; i++){
+		other = quic_fec_find(qp, first + i);
+		if(!other)
+			continue;
+		if(mask & (1 << i))
+			seq ^= other->sequence;
+		len ^= other->len;
+		for(j = 0; j < min_t(int, other->len, plen); j++)
+			buf[j] ^= other->data[j];
+	}
+	if(len > plen){
+		kfree_skb(nskb);
+		return NULL;
+	}
+	skb_trim(nskb, skb_transport_offset(nskb) + sizeof(struct quichdr) + len);
+	//the missing packet went out before the repair packet; a member retransmitted since then
+	//spoils the XOR, the repair packet's own sequence number is the safe guess
+	if(!(mask & (1 << (missing - first))) || !before(seq, quic_hdr(skb)->sequence))
+		seq = quic_hdr(skb)->sequence;
+	nqh = quic_hdr(nskb);
+	nqh->offset = missing;
+	nqh->sequence = seq;
+	nqh->type = htonl(DATA);
+	nqh->len = htons(sizeof(struct quichdr) + len);
+	nqh->check = 0;
+	nskb->ip_summed = CHECKSUM_UNNECESSARY;
+	qp->fec_recovered++;
+	pr_debug("Rebuilt packet %u from the repair packet of %u..%u\n", missing, first, first + n - 1);
+	return nskb;
 }
 
-/* final function which does the actual packet transmission, cloning the packet before sending to maintain a copy of them for retransmission, if necessary */
 int quic_finish_send_skb(struct sk_buff *skb, int clone, int retransmit)
 {
 	struct sock *sk = skb->sk;
@@ -1104,7 +3301,12 @@ int quic_finish_send_skb(struct sk_buff *skb, int clone, int retransmit)
 	struct quic_sock *qp = quic_sk(sk);
 	struct quichdr *qh;
 	struct quic_skb_cb *qb;
+	struct quic_path *p = NULL;
+	struct sk_buff *plain = skb;	//as queued, in clear
 	struct flowi4 *fl4;
+	__be32 saddr, daddr;
+	unsigned int pkt_len;	//in clear, as queued
+	bool protect;
 	int err = 0;
 	int offset = skb_transport_offset(skb);
 	int len = skb->len - offset;
@@ -1113,11 +3315,45 @@ int quic_finish_send_skb(struct sk_buff *skb, int clone, int retransmit)
 
 	fl4 = &inet->cork.fl.u.ip4;
 	qb = QUIC_SKB_CB(skb);
+	saddr = fl4->saddr;
+	daddr = fl4->daddr;
+	//new and lost packets go to the path picked by the scheduler, others stay on theirs
+	if(clone && (!retransmit || (qb->flags & QUIC_PKT_LOST)))
+		qb->path = max(quic_mpath_select(sk), 0);
+	if(clone && qb->path){
+		p = quic_mpath(qp, qb->path);
+		if(!p->rt || (!dst_check(&p->rt->dst, 0) && quic_mpath_route(sk, p, p->saddr))){
+			if(p->rt)
+				quic_mpath_fail(sk, qb->path);
+			qb->path = 0;
+			p = NULL;
+		}else{
+			saddr = p->saddr;
+			daddr = p->daddr;
+		}
+	}
+	if(clone && !retransmit && ntohl(quic_hdr(skb)->type) == FEC)
+		quic_fec_seq(sk, skb);
+	//packet protection: what goes out is a new packet for the ciphertext, no clone is needed
+	protect = rcu_access_pointer(qp->aead_tx) && !quic_is_handshake(quic_hdr(skb));
+	if(protect){
+		skb = quic_aead_skb(sk, plain);
+		if(!skb){
+			printk("Error allocating protected packet number %u\n", qb->offset);
+			if(!clone)
+				kfree_skb(plain);
+			return -ENOMEM;
+		}
 //clone != 0 -> clone the socket buffer
-	if(clone){
+	}else if(clone){
 		//printk("Number of packets in send queue = %d\n", skb_queue_len(&sk->sk_write_queue));
-		//Clone the skb before sending
-		skb = skb_clone(skb, GFP_ATOMIC); //with as little memory copy overhead as possible
+		/*  A clone shares the headers with the queued packet and with earlier clones that may
+		    still wait in a qdisc: a packet for another path or addresses gets its own copy of
+		    them, the data pages stay shared */
+		if(p || ip_hdr(skb)->saddr != saddr || ip_hdr(skb)->daddr != daddr)
+			skb = pskb_copy(skb, GFP_ATOMIC);
+		else
+			skb = skb_clone(skb, GFP_ATOMIC); //with as little memory copy overhead as possible
 	
 		if(skb == NULL){
 			printk("Error cloning skb");
@@ -1129,6 +3365,14 @@ int quic_finish_send_skb(struct sk_buff *skb, int clone, int retransmit)
 		skb->destructor = sock_wfree;
 		atomic_add(skb->truesize, &sk->sk_wmem_alloc);
 	}
+	if(protect || clone){
+		if(p){
+			skb_dst_drop(skb);
+			skb_dst_set(skb, dst_clone(&p->rt->dst));
+		}
+		ip_hdr(skb)->saddr = saddr;	//private header here, or the addresses did not change
+		ip_hdr(skb)->daddr = daddr;
+	}
 
 
 	/*
@@ -1138,10 +3382,12 @@ int quic_finish_send_skb(struct sk_buff *skb, int clone, int retransmit)
 
 	qh = quic_hdr(skb);
 	qh->source = inet->inet_sport;
-	qh->dest = fl4->fl4_dport;
+	qh->dest = p ? p->dport : fl4->fl4_dport;
 	qh->len = htons(len);
 	qh->check = 0;
 	qh->cid = qb->cid;
+	qh->mpath = p != NULL;
+	qh->rep = !!(qb->flags & QUIC_PKT_AFTER_FEC);
 	qh->conn_id = qp->conn_id;
 	//if(retransmit)
 	//	qb->sequence++;
@@ -1153,7 +3399,33 @@ int quic_finish_send_skb(struct sk_buff *skb, int clone, int retransmit)
 	}
 
 	qh->offset = qb->offset;
-	qh->type = qb->type;
+
+	//Timestamp = current time in us, taken before the checksum so every send path gets one
+	qb->timestamp = QUIC_TIMESTAMP;
+	if(clone){
+		quic_rate_skb_sent(sk, qb);
+		if(qp->ecn_flags & QUIC_ECN_OK)
+			qb->flags |= QUIC_PKT_ECT;
+		//smoothed packet length (1/8 gain), the pacing rate of the congestion control is in bytes
+		qp->avg_pkt_len = qp->avg_pkt_len ? qp->avg_pkt_len - (qp->avg_pkt_len >> 3) + (plain->len >> 3)
+						  : plain->len;
+	}
+	pkt_len = plain->len;
+
+	if(protect){
+		err = quic_aead_encrypt(sk, skb, plain);
+		if(!clone){
+			consume_skb(plain);
+			qb = QUIC_SKB_CB(skb);
+		}
+		if(err){
+			printk("Error protecting packet number %u\n", qb->offset);
+			kfree_skb(skb);
+			return err;
+		}
+		len = skb->len - offset;
+		qh->len = htons(len);
+	}
 
 	//printk("Sent packet with sequence = %u\n", qh->offset);
 
@@ -1164,7 +3436,7 @@ int quic_finish_send_skb(struct sk_buff *skb, int clone, int retransmit)
 
 	} else if (skb->ip_summed == CHECKSUM_PARTIAL) { /* QUIC hardware csum */
 
-		udp4_hwcsum(skb, fl4->saddr, fl4->daddr);
+		udp4_hwcsum(skb, saddr, daddr);
 		goto send;
 
 	} else{
@@ -1173,14 +3445,11 @@ int quic_finish_send_skb(struct sk_buff *skb, int clone, int retransmit)
 
 	/* add protocol-dependent pseudo-header */
 	//computes checkusum of the TCP/UDP pseudoheader, returns an already complemented result
-	qh->check = csum_tcpudp_magic(fl4->saddr, fl4->daddr, len,
+	qh->check = csum_tcpudp_magic(saddr, daddr, len,
 				      sk->sk_protocol, csum);
 	if (qh->check == 0)
 		qh->check = CSUM_MANGLED_0; //if 0, write as 0xFFFF
 
-	//Timestamp = current time from boot (jiffies)
-	qb->timestamp = jiffies;
-
 send:
 //what does the L3 send function return? 
 	err = ip_send_skb(sock_net(sk), skb);
@@ -1194,40 +3463,50 @@ send:
 	} else{ //if "no error" - alright!
 		UDP_INC_STATS_USER(sock_net(sk),
 				   UDP_MIB_OUTDATAGRAMS, 0);
+		if(clone && !qb->path && qp->ca_state == QUIC_CA_Recovery)
+			qp->prr_out += pkt_len;
 		if(!retransmit && clone){ //data packet, no retransmission
 			qp->packets_out++;
-			printk("Sent packet with offset = %u, sequence = %u, Packets out = %u\n", qh->offset, qh->sequence, qp->packets_out);
+			*quic_in_flight(qp, qb) += pkt_len;
+			pr_debug("Sent packet with offset = %u, sequence = %u, Packets out = %u, bytes in flight = %u\n", qh->offset, qh->sequence, qp->packets_out, qp->bytes_in_flight);
 		}else if(clone){ //data packet, retransmission
 			printk("Retransmitted packet with offset = %u, sequence = %u\n", qh->offset, qh->sequence);
 		}
-//if connections established, data packet sent and we're on client side -> set TLP/RTO timer for fast retransmit
-		if(sk->sk_state == TCP_ESTABLISHED && clone && !qp->server){
-			//Set Loss timer
-			//if(qp->nacked_in_q){
-			//	if(!timer_pending(&qp->quic_hshake_loss_timer)){
-			//		quic_reset_hshake_loss_timer(sk, 0.25*((qp->srtt)>>3));
-			//		printk("Set Loss timer for Fast retransmit\n");
-			//	}
-			//}
-
-			//Tail Loss Probes
-			if(qp->tlp_out < 2){
-				if(qp->packets_out == 1){
-					quic_reset_rto_tlp_timer(sk, max( 1.5*(qp->srtt>>3)+QUIC_DEL_ACK,  2*(qp->srtt>>3)));
-				}else if(qp->packets_out > 1){
-					quic_reset_rto_tlp_timer(sk, max( msecs_to_jiffies(10),  2*(qp->srtt>>3)));
-				}
-			}else if(qp->tlp_out == 2){
-				if(!timer_pending(&qp->quic_rto_tlp_timer)){
-					printk("In quic finish send......");
-					quic_reset_rto_tlp_timer(sk, qp->rto);
-				}
-			}
+//if connections established and data packet sent -> (re)arm the PTO from this send, on both sides
+		if(sk->sk_state == TCP_ESTABLISHED && clone){
+			qp->last_sent_time = qb->timestamp;
+			quic_set_loss_detection_timer(sk);
 		}
 	}
 
 	return err;
 }
+/* Retransmits the packets declared lost, oldest first, as far as the congestion window allows.
+   A retransmission is in flight again and gets a new sequence number */
+static int quic_retransmit_lost(struct sock *sk){
+	struct sk_buff *skb;
+	struct quic_sock *qp = quic_sk(sk);
+	struct quic_skb_cb *qb;
+	int err = 0;
+
+	skb_queue_walk(&sk->sk_write_queue, skb) {
+		if(!qp->lost_out || !quic_mpath_can_send(sk))
+			break;
+		qb = QUIC_SKB_CB(skb);
+		if(qb->flags & QUIC_PKT_LOST){
+			err = quic_finish_send_skb(skb, 1, 1);
+			if(err)
+				break;
+			qb->flags = (qb->flags & ~QUIC_PKT_LOST) | QUIC_PKT_RETRANS;
+			qp->lost_out--;
+			qp->packets_out++;
+			*quic_in_flight(qp, qb) += skb->len;
+		}
+		if(skb == qp->last_sent)
+			break;
+	}
+	return err;
+}
 /* This function is called to transmit packets from the send queue, and implements asynchronous packet sending. It first checks whether the queue is empty/packets sent have already filled the congestion window */
 int try_send_packets(struct sock *sk){
 	struct sk_buff *skb;
@@ -1236,6 +3515,8 @@ int try_send_packets(struct sock *sk){
 //if nothing to send
 	qp->sending = 1;
 	if(skb_queue_empty(&sk->sk_write_queue)){
+		quic_rate_check_app_limited(sk);
+		qp->fec_cnt = 0;	//all acknowledged, nothing left to protect
 		qp->sending = 0;
 		return 0;
 	}
@@ -1244,21 +3525,34 @@ int try_send_packets(struct sock *sk){
 	//	qp->sending = 0;
 	//	return 0;
 	//}
-//if congestion window full
-	if(qp->packets_out >= qp->cwnd){
+//if the congestion windows of all paths are full (the last packet may overshoot them)
+	if(!quic_mpath_can_send(sk)){
 		qp->sending = 0;
 		return 0;
 	}
+//lost packets go before new data
+	if(qp->lost_out){
+		err = quic_retransmit_lost(sk);
+		if(err){
+			qp->sending = 0;
+			return err;
+		}
+	}
 //send packets until the buffer is empty or the congestion window full
-	while(qp->packets_out < qp->cwnd){ //as long as cwnd hasn't been filled
+	while(quic_mpath_can_send(sk)){ //as long as cwnd hasn't been filled
 		if(IS_ERR_OR_NULL(qp->last_sent)){
 			if(skb_queue_empty(&sk->sk_write_queue)){ //if nothing more to send, stop
+				quic_rate_check_app_limited(sk);
+				qp->fec_cnt = 0;
 				qp->sending = 0;
 				qp->last_sent = NULL;
 				return 0;
 			}
 			skb = skb_peek(&sk->sk_write_queue); //returns pointer to first item of the list
 		}else if(skb_peek_tail(&sk->sk_write_queue) == qp->last_sent){
+			if(quic_fec_send(sk))	//out of data, protect the tail
+				continue;
+			quic_rate_check_app_limited(sk);	//everything sent
 			qp->sending = 0;
 			return 0;
 		}else {
@@ -1357,6 +3651,14 @@ try_again:
 	if (inet->cmsg_flags){
 		ip_cmsg_recv(msg, skb);
 	}
+	//handshake packet for the daemon, only a socket in its mode is given them
+	if (quic_sk(sk)->hs_user && quic_hdr(skb)->cid && quic_is_handshake(quic_hdr(skb))){
+		struct quic_handshake_msg hm;
+
+		hm.type = ntohl(quic_hdr(skb)->type);
+		hm.conn_id = quic_hdr(skb)->conn_id;
+		put_cmsg(msg, SOL_QUIC, QUIC_HANDSHAKE, sizeof(hm), &hm);
+	}
 
 	err = copied;
 	if (flags & MSG_TRUNC)
@@ -1678,179 +3980,125 @@ bool is_in_rcv_q(struct sock *sk, __be32 offset){
 
 	return 0;
 }
-//deletes ACKed frames and decides what to do (e.g. reset TLP/RTO timers)
-int delete_acked(struct sock *sk){
+/*  Whether the ACK of a retransmitted packet was caused by its original transmission: known for
+    the packet the ACK was generated for, otherwise inferred when the ACK came back sooner than
+    the minimum RTT after the retransmission */
+static bool quic_retrans_spurious(const struct quic_sock *qp, struct sk_buff *skb,
+				  __be32 ack_sequence, u32 now){
+	struct quic_skb_cb *qb = QUIC_SKB_CB(skb);
+
+	if(qb->offset == qp->highest_ack)
+		return qb->sequence != ack_sequence;
+	return qp->min_rtt != ~0U && (s32)(now - qb->timestamp) < (s32)qp->min_rtt;
+}
+
+/*  Single pass over the send queue for one ACK. Every packet up to highest_ack is either listed in
+    the NACK frames of the ACK or newly ACKed; every packet sent and not ACKed, NACKed or beyond
+    highest_ack, is checked for loss against the largest ACKed transmission. ACKed packets are
+    unlinked on the way and collected in "acked", so the caller can free them as one batch once
+    congestion control and the timers have been updated. "nack" points to the first NACK/END frame,
+    or is NULL if the ACK carries no NACK list at all (e.g. the ACK in the hello reply) */
+static int quic_clean_rtx_queue(struct sock *sk, const struct ack_frame *nack,
+				__be32 ack_sequence, struct quic_ack_sample *rs,
+				struct sk_buff_head *acked){
 	struct quic_sock *qp = quic_sk(sk);
-	struct sk_buff *skb, *skb_temp;
+	struct sk_buff *skb, *tmp, *last = qp->last_sent;
 	struct quic_skb_cb *qb;
-	int count = 0, position = 0;
-	bool end = 0;
+	u32 now = QUIC_TIMESTAMP;
+	u32 loss_delay = quic_loss_delay(qp);
 
-	if(skb_queue_empty(&sk->sk_write_queue)){
-		printk("delete_acked(): Send queue empty\n");
-		return count;
-	}
+	memset(rs, 0, sizeof(*rs));
+	if(IS_ERR_OR_NULL(last))
+		goto out;		//nothing has been sent
 
-	skb = skb_peek(&sk->sk_write_queue);
-	qb = QUIC_SKB_CB(skb);
+	skb_queue_walk_safe(&sk->sk_write_queue, skb, tmp) {
+		bool end = (skb == last);	//everything after the last sent packet is unsent
 
-	//printk("delete_acked()\nfirst packet offset = %u\nHighest acked = %u\n", qb->offset, qp->highest_ack);
-
-	while (qb->offset <= qp->highest_ack){
-		position++;
-		if(skb == skb_peek_tail(&sk->sk_write_queue))   //if we've reached the end
-			end = 1;    
-		if(!qb->missing_reports){                       //if no missing reports
-			printk("Deleting ACKed frame with offset %u\n", qb->offset);
-			if(skb == qp->last_sent){
-				if(skb == skb_peek(&sk->sk_write_queue)){
-					qp->last_sent = NULL;
-				}else{
-					qp->last_sent = skb->prev;
-				}
+		qb = QUIC_SKB_CB(skb);
+		if(qb->offset > qp->highest_ack){
+			quic_check_lost(sk, skb, now, loss_delay, rs);
+			goto next;
+		}
+
+		//NACK frames are sorted by offset, skip those for packets already gone
+		while(nack && ntohl(nack->id) == NACK && ntohl(nack->offset) < qb->offset)
+			nack++;
+
+		if(nack && ntohl(nack->id) == NACK && ntohl(nack->offset) == qb->offset){
+			rs->nacked++;
+			nack++;
+			qb->flags |= QUIC_PKT_NACKED;
+			quic_check_lost(sk, skb, now, loss_delay, rs);
+			goto next;
+		}
+
+		//newly ACKed - the packet the ACK was generated for gives the RTT sample
+		if(qb->offset == qp->highest_ack && qb->sequence == ack_sequence){
+			rs->sent_time = qb->timestamp;
+			rs->rtt_valid = 1;
+			rs->rtt_path = qb->path;
+		}
+		//a packet sent after the recovery period started ends it
+		if(!qb->path && after(qb->timestamp, qp->recovery_start))
+			rs->recovered = 1;
+
+		if(skb == qp->last_sent){
+			if(skb == skb_peek(&sk->sk_write_queue)){
+				qp->last_sent = NULL;
+			}else{
+				qp->last_sent = skb->prev;
 			}
-			skb_temp = skb->next;
-			skb_unlink(skb, &sk->sk_write_queue);
-			kfree_skb(skb); //this socket buffer isn't needed anymore - delete
-			if(!qp->packets_out) //packets_out should be at least 1
+		}
+		__skb_unlink(skb, &sk->sk_write_queue);
+		__skb_queue_tail(acked, skb);
+
+		//the other paths have congestion control of their own
+		if(qb->path){
+			quic_mpath_acked(sk, skb);
+			rs->mp_acked++;
+			goto next;
+		}
+		if(after(qb->sequence, qp->mp_acked_seq))
+			qp->mp_acked_seq = qb->sequence;
+		if(qb->flags & QUIC_PKT_LOST){
+			qp->lost_out--;		//arrived after all, no retransmission needed
+			rs->spurious++;
+			quic_reorder_sample(qp, skb, now, rs);
+		}else{
+			if(!qp->packets_out){ //packets_out should be at least 1
 				printk("Error: packets_out is incorrectly  0\n");
-			qp->packets_out--;
-			count++;
-//this part of the code has been already explained in the congestion control part
-			//ACK received after RTO
-			if(qp->number_rto_packets){
-				//If packet other than sent after RTO is ACKed, recover CWND
-				if(position > qp->number_rto_packets){
-					bictcp_undo_cwnd(sk);
-				}
-				//case "closed" - packets ACKed after RTO 
-				qp->number_rto_packets = 0;
+			}else{
+				qp->packets_out--;
 			}
-
-            //TLP/RTO timer handling
-			//Restart TLP timer with the usual formula
-			if(qp->packets_out == 0){
-				if(timer_pending(&qp->quic_rto_tlp_timer))
-					quic_clear_rto_tlp_timer(sk);
-			}else if(qp->packets_out == 1){
-				qp->tlp_out = 0;
-				qp->retransmits = 0;
-				quic_reset_rto_tlp_timer(sk, max( 1.5*(qp->srtt>>3)+QUIC_DEL_ACK,  2*(qp->srtt>>3)));
-			}else if(qp->packets_out > 1){
-				qp->tlp_out = 0;
-				qp->retransmits = 0;
-				quic_reset_rto_tlp_timer(sk, max( msecs_to_jiffies(10),  2*(qp->srtt>>3)));
+			qp->bytes_in_flight -= min(skb->len, qp->bytes_in_flight);
+			if(qb->flags & QUIC_PKT_RETRANS){
+				if(quic_retrans_spurious(qp, skb, ack_sequence, now))
+					rs->spurious++;
+				else
+					rs->undo_fail = 1;
+			}else if(qb->flags & QUIC_PKT_NACKED){
+				quic_reorder_sample(qp, skb, now, rs);
 			}
-
-		}else{
-			skb_temp = skb->next;
 		}
-
+		quic_rate_skb_delivered(sk, skb, rs);
+		rs->acked++;
+		rs->acked_bytes += skb->len;
+		if(qb->flags & QUIC_PKT_ECT)
+			rs->ect_acked++;
+next:
 		if(end)
-			return count;       //number of ACKed packets
-		skb = skb_temp;
-		qb = QUIC_SKB_CB(skb);
-	}
-	//if no packets are out, or the write queue is empty, or both -> clear the timers
-	if(!qp->packets_out || skb_queue_empty(&sk->sk_write_queue)){
-		printk("Packets out = %u, clearing the timers\n", qp->packets_out);
-		qp->packets_out = 0;
-		quic_clear_hshake_loss_timer(sk);
-		quic_clear_rto_tlp_timer(sk);
+			break;
 	}
-    //change first_unack pointer (first packet which needs to be acknowledged)
+
+out:
+	//change first_unack pointer (first packet which needs to be acknowledged)
 	if(skb_queue_empty(&sk->sk_write_queue)){
 		qp->first_unack = qp->send_next;
 	}else{
-	qp->first_unack = QUIC_SKB_CB(skb_peek(&sk->sk_write_queue))->offset;
-	}
-
-	return count;
-
-}
-//counts the number of ACKed packets (same implementation as in delete_acked())
-int count_acked(struct sock *sk){
-	struct quic_sock *qp = quic_sk(sk);
-	struct sk_buff *skb;
-	struct quic_skb_cb *qb;
-	int count = 0;
-	bool end = 0;
-//no packets at all in the write queue
-	if(skb_queue_empty(&sk->sk_write_queue)){
-		return count;
-	}
-
-	skb = skb_peek(&sk->sk_write_queue);
-	qb = QUIC_SKB_CB(skb);
-
-	//printk("delete_acked()\nfirst packet offset = %u\nHighest acked = %u\n", qb->offset, qp->highest_ack);
-
-	while (qb->offset <= qp->highest_ack){
-		if(skb == skb_peek_tail(&sk->sk_write_queue))
-			end = 1;
-		if(!qb->missing_reports) //NACK count == 0 -> increment number of ACKed packets
-			count++;
-		if(end)
-			return count;
-		skb = skb->next; //jump to next socket buffer
-		qb = QUIC_SKB_CB(skb);
-	}
-	return count;
-
-}
-
-/* retransmit NACKed packets - this function gets called upon loss timer expiration (loss_hshake_timer_handler) */
-
-void retransmit_nacked(struct sock *sk, const unsigned int threshold){ //RESEND_THRESHOLD defined as 3 in header
-	struct quic_sock *qp = quic_sk(sk);
-	struct sk_buff *skb, *skb_end;
-	struct quic_skb_cb *qb;
-	int sent = 0;
-
-	printk("Entered retransmit function\n");
-	if(skb_queue_empty(&sk->sk_write_queue)){
-		printk("Error: send queue empty on loss timer expiration\n");
-		return;
+		qp->first_unack = QUIC_SKB_CB(skb_peek(&sk->sk_write_queue))->offset;
 	}
 
-	skb = skb_peek(&sk->sk_write_queue);
-	skb_end = skb_peek_tail(&sk->sk_write_queue);
-	goto first_time;
-
-	do{
-		if(IS_ERR_OR_NULL(skb) || IS_ERR_OR_NULL(skb_end))
-			return;
-		skb = skb->next;
-first_time:	
-		if(IS_ERR_OR_NULL(skb) || IS_ERR_OR_NULL(skb_end)){
-			printk("Error skb in retransmit\n");
-			return;
-		}
-		qb = QUIC_SKB_CB(skb);
-		if(IS_ERR_OR_NULL(skb) || IS_ERR_OR_NULL(skb_end)){
-			printk("Error skb in retransmit\n");
-			return;
-		}//similar to TCP's "3-duplicate ACKs" logic -> in this case, fast retransmit
-		if(qb->missing_reports > threshold){
-			if(IS_ERR_OR_NULL(skb) || IS_ERR_OR_NULL(skb_end)){
-				printk("Error skb in retransmit\n");
-				return;
-			}
-			quic_finish_send_skb(skb,1, 1); //send this packet immediately
-			sent++;
-			qb->missing_reports = 0;
-			printk("Fast Retransmitting packet number %u\n", qb->offset);
-		}else if(qb->missing_reports == 0){ //packet hasn't been tested at all
-			//printk("reached untested packet number %u, breaking\n", qb->offset);
-			break;
-		}else {
-			if(IS_ERR_OR_NULL(skb) || IS_ERR_OR_NULL(skb_end))
-				return;
-			//printk("Not Retransmitting packet number %u\n", qb->offset);
-		}
-		if(IS_ERR_OR_NULL(skb) || IS_ERR_OR_NULL(skb_end))
-			return;
-	}while((skb != skb_end) && (sent <= qp->cwnd)); //as long as write queue/congestion window go
+	return rs->acked;
 }
 /* function has been borrowed from the TCP code to update RTT variables (see Communication Networks lecture) RTO = rtt + 4 * mdev and so on */
 
@@ -1878,6 +4126,9 @@ static void process_RTT(struct sock *sk, const __u32 mrtt)
 	 */
 	if (m == 0)
 		m = 1;
+	qp->latest_rtt = m;
+	if (m < qp->min_rtt)
+		qp->min_rtt = m;
 	if (!qp->first_rtt) {
 		m -= (qp->srtt >> 3);	/* m is now error in rtt est */
 		qp->srtt += m;		/* rtt = 7/8 rtt + 1/8 new */
@@ -1907,13 +4158,13 @@ static void process_RTT(struct sock *sk, const __u32 mrtt)
 			if (qp->mdev_max < qp->rttvar)
 				qp->rttvar -= (qp->rttvar - qp->mdev_max) >> 2;
 			qp->rtt_seq = qp->send_next;
-			qp->mdev_max = tcp_rto_min(sk);
+			qp->mdev_max = QUIC_RTO_MIN;
 		}
 	} else {
 		/* no previous measure. */
 		qp->srtt = m << 3;	/* take the measured time to be rtt */
 		qp->mdev = m << 1;	/* make sure rto = 3*rtt */
-		qp->mdev_max = qp->rttvar = max(qp->mdev, tcp_rto_min(sk));
+		qp->mdev_max = qp->rttvar = max_t(u32, qp->mdev, QUIC_RTO_MIN);
 		qp->rtt_seq = qp->send_next;
 		qp->first_rtt = 0;
 	}
@@ -1925,18 +4176,116 @@ static void process_RTT(struct sock *sk, const __u32 mrtt)
 		qp->rto = QUIC_RTO_MAX; //if rto too high, cap it to RTO_MAX
 }
 
+/*  ECN (RFC 9000 section 13.4, RFC 9002 section 7.1). Our packets carry ECT(0) (set through
+    inet->tos, so ACKs and handshake packets are marked too, as QUIC does) while the path is
+    validated. The receiver counts the codepoints of the data packets it gets and, once it has
+    seen any, appends the counts to each ACK after the NACK frames, where older peers stop
+    parsing. A growing CE count is a congestion event like a loss, without any retransmission.
+    ECN is turned off if an ACK of new packets does not show the ECT(0) or CE count increase,
+    i.e. the peer does not support it or the path clears the codepoint */
+
+//count the codepoint of a received data packet
+static inline void quic_ecn_rcv(struct quic_sock *qp, const struct sk_buff *skb){
+	switch(ip_hdr(skb)->tos & INET_ECN_MASK){
+	case INET_ECN_ECT_0:
+		qp->ecn_rcv[0]++;
+		break;
+	case INET_ECN_ECT_1:
+		qp->ecn_rcv[1]++;
+		break;
+	case INET_ECN_CE:
+		qp->ecn_rcv[2]++;
+		break;
+	default:
+		return;
+	}
+	qp->ecn_flags |= QUIC_ECN_SEEN;
+}
+
+//ECN counts following the NACK frames of an ACK; returns 0 if the ACK carries none
+static bool quic_parse_ecn(const struct ack_frame *frame, u32 *ecn){
+	bool found = 0;
+
+	while(ntohl(frame->id) == NACK)
+		frame++;
+	for(;; frame++){
+		switch(ntohl(frame->id)){
+		case ECN_ECT0:
+			ecn[0] = ntohl(frame->offset);
+			break;
+		case ECN_ECT1:
+			ecn[1] = ntohl(frame->offset);
+			break;
+		case ECN_CE:
+			ecn[2] = ntohl(frame->offset);
+			break;
+		default:
+			return found;
+		}
+		found = 1;
+	}
+}
+
+//FEC_RECOVERED count following the NACK frames and ECN counts of an ACK; returns 0 if none
+static bool quic_parse_fec(const struct ack_frame *frame, u32 *recovered){
+	for(;; frame++){
+		switch(ntohl(frame->id)){
+		case NACK:
+		case ECN_ECT0:
+		case ECN_ECT1:
+		case ECN_CE:
+			break;
+		case FEC_RECOVERED:
+			*recovered = ntohl(frame->offset);
+			return 1;
+		default:
+			return 0;
+		}
+	}
+}
+
+/*  Validate ECN and detect new CE marks with an ACK which newly ACKed packets sent with ECT(0)
+    (RFC 9000 section 13.4.2.1): the ECT(0) and CE counts must cover every such packet ACKed so
+    far. Counting is cumulative as the counts of an ACK may already include packets above its
+    largest one (an ACK cut at the NACK limit), which a later ACK then ACKs without new counts;
+    packets sent before marking started, or after it stopped, do not count */
+static void quic_ecn_ack(struct sock *sk, const struct ack_frame *nack, struct quic_ack_sample *rs){
+	struct quic_sock *qp = quic_sk(sk);
+	u32 ecn[3] = { 0, 0, 0 };
+	bool found;
+
+	if(!(qp->ecn_flags & QUIC_ECN_OK) || !rs->ect_acked)
+		return;
+	qp->ecn_ect_sent += rs->ect_acked;
+	found = quic_parse_ecn(nack, ecn);
+	if(!found || ecn[0] + ecn[2] < qp->ecn_ect_sent){
+		printk("ECN validation failed, not marking packets anymore\n");
+		qp->ecn_flags &= ~QUIC_ECN_OK;
+		INET_ECN_dontxmit(sk);
+		return;
+	}
+	qp->ecn_ect_acked = ecn[0] + ecn[2];
+	if(ecn[2] > qp->ecn_ce_acked){
+		printk("Peer reported %u new CE marks\n", ecn[2] - qp->ecn_ce_acked);
+		qp->ecn_ce_acked = ecn[2];
+		rs->ce = 1;
+	}
+}
+
 /*  This function is called if the received packet is an ACK packet. It first checks if this
-    is an out-of-order ACK/if send queue is empty (then return). If not, process_RTT is called
-    and RTT values are updated */
+    is an out-of-order ACK/if send queue is empty (then return). If not, the send queue is walked
+    once: ACKed and NACKed packets are classified, the RTT is sampled, congestion control is
+    updated and the loss timers are armed once, and the ACKed packets are freed together */
 
 
 int process_ack(struct sock *sk, struct sk_buff *skb, struct ack_frame *ack){
-	struct sk_buff *skb_temp;
-	struct quic_skb_cb *qb;
 	struct quic_sock *qp = quic_sk(sk);
-	unsigned int count = 0;
-	bool found = 0, firsft = 1;
 	struct quichdr *qh = quic_hdr(skb);
+	struct quic_ack_sample rs;
+	struct sk_buff_head acked;
+	unsigned int prior_in_flight;
+	__u32 delta;
+	s32 rtt = -1;
 //ntohl function coverts unsigned integer from network byte order to host byte order
 	if(
 			((qp->highest_ack == ntohl(ack->offset)) && (qp->highest_ack_sequence <= ntohl(qh->sequence))) //new sequence number
@@ -1959,160 +4308,86 @@ int process_ack(struct sock *sk, struct sk_buff *skb, struct ack_frame *ack){
 	if(qp->syn_acked == 0)
 		qp->syn_acked = 1;
 	ack++;
-
-	skb_temp = find_in_send_q(sk, ntohl(qh->offset));
-	qb = QUIC_SKB_CB(skb_temp);
-	if(!IS_ERR_OR_NULL(skb_temp)){
-		if(qb->sequence != ntohl(qh->sequence)){
-			printk("Warning: RTT measurement not valid, sent seq = %u, rcv seq = %u\n", qb->sequence, ntohl(qh->sequence));
-			ack++;
-			goto process_nack;
-		}
-	}else{
-		printk("Packet with offset %u already acked, skipping RTT measurement....\n", ntohl(qh->offset));
-		ack++;
-		goto process_nack;
-	}
-//sampling RTT (DELTA = time difference between when packet was received and packet was sent):
-//provides for a better RTT estimate
-	if(ntohl(ack->id) == DELTA){ //if this ACK frame carries Delta information
-		if(!IS_ERR_OR_NULL(skb_temp)){
-			qp->highest_ack_rtt = jiffies - qb->timestamp - (unsigned long) ntohl(ack->offset);
-		}else{
-			printk("Error: SKB disappeared while taking RTT, skipping....\n");
-			ack++;
-			goto process_nack;
-		}
-//if RTT isn't too high, RTO updated according to known algorithm!
-		if(qp->highest_ack_rtt < 1000){
-			process_RTT(sk, qp->highest_ack_rtt);
-			//printk("For Offset %u\nMeasured RTT = %ums, SRTT = %ums\n", qb->offset, qp->highest_ack_rtt, qp->srtt>>3);
-		}else{
-			printk("Warning: Not processing RTT value for this ACK\n");
-			printk("For Offset %u\nNow = %lu\nSent = %u\nDelta value = %u\nMeasured RTT = %u\n", qb->offset, jiffies, qb->timestamp, ntohl(ack->offset), qp->highest_ack_rtt);
-		}
-		ack++;
-	}else{ //if no Delta tag, then the acknowledgment is corrupt
+
+//DELTA = time difference between when packet was received and when the ACK was sent
+	if(ntohl(ack->id) != DELTA){ //if no Delta tag, then the acknowledgment is corrupt
 		printk("Error: Corrupt acknowledgement, no Delta tag, tag value = %u\n", ntohl(ack->id));
 		return 1;
 	}
-//check whether there are negative acknowledgments and handle them
-process_nack:
-
-	skb_temp = skb_peek(&sk->sk_write_queue);
-
-	//NO NACKs in this ACK
-	if(ntohl(ack->id) == END){
-		goto start_here;
-		//do-while structure is there in order to avoid this!!!
-		while(skb_temp != skb_peek_tail(&sk->sk_write_queue)){
-			skb_temp = skb_temp->next;
-start_here:
-			qb = QUIC_SKB_CB(skb_temp);
-			if(IS_ERR_OR_NULL(skb_temp)){
-				printk("Warning: Dangling skb pointer in write queue....aborting process_ack()\n");
-				return -1;
-			}
-//these frames can be ACKed
-			if(qb->offset <= qp->highest_ack){
-				qb->missing_reports = 0;
-				printk("Acked frame %u\n", qb->offset);
-			}else if(qb->offset > qp->highest_ack){
-				break;
-			}
-		}
-		qp->nacked_in_q = 0;
-		goto processed;
-	}
-
-//processing NACK frames, if there are some
-	while( ntohl(ack->id) != END){
-		if(ntohl(ack->id) != NACK){
-			printk("Error: Invalid type for NACK frame\n");
-			return -1;
-		}
-
-		found = 0;
-		goto first_itr;
-
-		while(skb_temp != skb_peek_tail(&sk->sk_write_queue)){
-			skb_temp = skb_temp->next;
-first_itr:
-			if(IS_ERR_OR_NULL(skb_temp)){
-				printk("Warning: Dangling skb pointer in write queue....aborting process_ack()\n");
-				return -1;
-			}
-/*  QUIC FACK logic: instead of waiting for 3-duplicate ACKs, each NACKed packet in the send 
-    queue has its 'missing reports' incremented as per the equation "missing_reports =
-    highest_received_offset - packet_offset. If resend_threshold is exceeded, retransmit. */
-			qb = QUIC_SKB_CB(skb_temp);
-			if(qb->offset == ntohl(ack->offset)){
-				qb->missing_reports+= qp->highest_ack - qb->offset;
-				printk("Frame with offset %u NACKed %u times\n", qb->offset, qb->missing_reports);
-				if(first){
-                			//if(timer_pending(&qp->quic_hshake_loss_timer)){
-					if(qp->first_nack < ntohl(ack->offset)){
-						if(timer_pending(&qp->quic_hshake_loss_timer))
-							quic_clear_hshake_loss_timer(sk);
-						qp->first_nack = ntohl(ack->offset);
-					}
-					first = 0;
-				}
-
-				found = 1;
-				skb_temp = skb_temp->next;
-				count++;        //number of NACKed packets
-				break;
-
-			}else if(qb->offset < ntohl(ack->offset)){
-				qb->missing_reports = 0;
-				printk("Acked frame %u\n", qb->offset);
-
-			}else if(qb->offset > ntohl(ack->offset)){
-				printk("Error: NACK not found\nOffset %u greater than NACK %u\n", qb->offset, ntohl(ack->offset));
-				break;
+	delta = ntohl(ack->offset);
+	ack++;
 
-			}else{
-				printk("Error: Unforseen condition in process_ack()\n");
-				return -1;
-			}
+	prior_in_flight = qp->bytes_in_flight;
+	__skb_queue_head_init(&acked);
+	quic_clean_rtx_queue(sk, ack, ntohl(qh->sequence), &rs, &acked);
+
+//sampling RTT in us: provides for a better RTT estimate
+	if(rs.rtt_valid){
+		rtt = (s32)(QUIC_TIMESTAMP - rs.sent_time);
+		//take out the time the receiver held the ACK back, unless it would make the sample negative
+		if(rtt > (s32)delta)
+			rtt -= delta;
+		if(rtt >= 0 && rs.rtt_path){
+			quic_mpath_rtt(quic_mpath(qp, rs.rtt_path), rtt);
+			rtt = -1;	//not a sample of path 0
+		}else if(rtt >= 0){
+			qp->highest_ack_rtt = rtt;
+			process_RTT(sk, qp->highest_ack_rtt);
+		}else{
+			printk("Warning: Not processing RTT value for this ACK\n");
+			printk("For Offset %u\nNow = %u\nSent = %u\nDelta value = %u\n", qp->highest_ack, QUIC_TIMESTAMP, rs.sent_time, delta);
+			rtt = -1;
 		}
-
-		ack++;
+	}else{
+		printk("Packet with offset %u already acked, skipping RTT measurement....\n", qp->highest_ack);
 	}
 
+	pr_debug("NACKed %u packets, declared %u lost\n", rs.nacked, rs.lost);
+	qp->nacked_in_q = rs.nacked;
+	quic_rate_gen(sk, &rs);		//its spacing is also used to classify losses
+	if(rs.reordered)
+		quic_reorder_update(sk, rs.reorder, rs.reorder_time);
+	quic_on_packets_lost(sk, &rs);
+	quic_ecn_ack(sk, ack, &rs);
+	if(qp->fec){
+		u32 recovered = qp->fec_recovered_acked;
+
+		quic_parse_fec(ack, &recovered);
+		quic_fec_adapt(sk, &rs, recovered - qp->fec_recovered_acked);
+		qp->fec_recovered_acked = recovered;
+	}
+	if(rs.ce){
+		//congestion event for the largest ACKed packet, nothing to retransmit and never undone
+		quic_enter_recovery(sk, &rs, rs.rtt_valid ? rs.sent_time : QUIC_TIMESTAMP);
+		qp->undo_marker = 0;
+	}
+	quic_check_undo(sk, &rs);
 
-	printk("NACKed %u packets\n", count);
-	qp->nacked_in_q = count;
-//if no NACKs, continue here!
-processed:
-	count = count_acked(sk);
-//if no NACKs (which means no out-of-order packets)
-	if(!qp->nacked_in_q){
-		if(count){
-			qp->ca_state = QUIC_CA_Open;
-		}
-		if(timer_pending(&qp->quic_hshake_loss_timer))
-			quic_clear_hshake_loss_timer(sk);
-	//	if(timer_pending(&qp->quic_rto_tlp_timer))
-	//		quic_clear_rto_tlp_timer(sk);
-	}else{
-		qp->ca_state = QUIC_CA_Disorder; //order has been "disturbed"
+//recovery ends with the first ACK of a packet sent after it started
+	if(qp->ca_state == QUIC_CA_Recovery && rs.recovered && !rs.lost && !rs.ce){
+		quic_prr_exit(sk);
+		qp->ca_state = QUIC_CA_Open;
 	}
+	if(qp->ca_state != QUIC_CA_Recovery)
+		qp->ca_state = qp->nacked_in_q ? QUIC_CA_Disorder : QUIC_CA_Open;
 
-//threshold and congestion window are updated
-	bictcp_cong_avoid(sk, qp->highest_ack, count, qp->packets_out);
+//threshold and congestion window are updated by the congestion control algorithm
+	qp->ca_ops->on_ack(sk, &rs, prior_in_flight, rtt);
+	if(qp->ca_state == QUIC_CA_Recovery)
+		quic_prr_update(sk, rs.acked_bytes);
+	quic_update_pacing_rate(sk);
 
-	if(count)
-		bictcp_acked(sk, count, qp->srtt);
+	if(rs.acked || rs.mp_acked)
+		qp->pto_count = 0;	//the peer is responsive
 
-//ACKed socket is deleted as it isn't needed anymore
-	delete_acked(sk);
+	quic_set_loss_detection_timer(sk);
+
+//ACKed packets aren't needed anymore, free them in one go
+	__skb_queue_purge(&acked);
 
 	printk("Congestion window = %u, SSThreshold = %u\n", qp->cwnd, qp->ssthresh);
 	return 0;
 }
-
 /* This function handles actual ACK sending - called by the "possibly_send_ack()" function */
 
 int send_ack(struct sock *sk){
@@ -2124,25 +4399,24 @@ int send_ack(struct sock *sk){
 	struct inet_sock *inet = inet_sk(sk);
 	struct flowi4 *fl4 = &inet->cork.fl.u.ip4;
 	int err, count = 0;
-	__be32 i;
+	__be32 i, highest, rcvd;
 	__be32 *end;
 
-	skb = quic_ip_make_skb(sk, fl4, 1024);
+	skb = quic_ip_make_skb(sk, fl4, QUIC_ACK_SPACE);
 
 	//skb_queue_tail(&sk->sk_write_queue, skb);
 
-	qb = QUIC_SKB_CB(skb);
-	memset(qb, 0, sizeof(struct quic_skb_cb));
-
-	qh = quic_hdr(skb);
-
 	err = PTR_ERR(skb);
 	if (!IS_ERR_OR_NULL(skb)){
+		qb = QUIC_SKB_CB(skb);
+		memset(qb, 0, sizeof(struct quic_skb_cb));
+
+		qh = quic_hdr(skb);
 
         //normal case = ACK frame followed by Delta frame for processing time at receiver
 		skb_put(skb, sizeof(ack_send->offset));
 		ack_send = (struct ack_frame *)&qh->type;
-		qb->type = htonl(ACK);
+		ack_send->id = htonl(ACK);
 		ack_send->offset = htonl(qp->highest_rcv);
 		qb->offset = htonl(qp->highest_rcv);
 		qb->sequence = htonl(qp->highest_rcv_sequence);
@@ -2151,27 +4425,62 @@ int send_ack(struct sock *sk){
 		skb_put(skb, sizeof(struct ack_frame));
 		ack_send++;
 		ack_send->id = htonl(DELTA);
-		ack_send->offset = htonl((__be32) (jiffies - qp->highest_rcv_time));
+		ack_send->offset = htonl((__be32) (QUIC_TIMESTAMP - qp->highest_rcv_time));	//ack delay in us
 
        
+		/*  NACKs for the missing packets, as many as fit in the ACK. With more gaps the ACK
+		    stops short of the first one left out, at the highest packet received before it,
+		    as everything up to the highest packet acknowledged and not NACKed counts as
+		    received; the next ACK reports the rest */
+		highest = qp->highest_rcv;
+		rcvd = qp->rcv_next - 1;
 		for(i = qp->rcv_next; i < qp->highest_rcv; i++){
+			if(is_in_rcv_q(sk, i)){
+				rcvd = i;
+				continue;
+			}
+			if(count == QUIC_ACK_MAX_NACKS){
+				highest = rcvd;
+				break;
+			}
 			//adding NACK for those missing packets (NACK frame)
-			if(!is_in_rcv_q(sk, i)){
-				printk("Adding NACK for %u\n", i);
-				count++;
+			printk("Adding NACK for %u\n", i);
+			count++;
+			skb_put(skb, sizeof(struct ack_frame));
+			ack_send++;
+			ack_send->id = htonl(NACK);
+			ack_send->offset = htonl(i);
+		}
+		if(highest != qp->highest_rcv){
+			((struct ack_frame *)&qh->type)->offset = htonl(highest);
+			qb->offset = htonl(highest);
+		}
+
+		//ECN counts, once the peer marks its packets
+		if(qp->ecn_flags & QUIC_ECN_SEEN){
+			static const u32 ecn_ids[3] = { ECN_ECT0, ECN_ECT1, ECN_CE };
+			int j;
+
+			for(j = 0; j < 3; j++){
 				skb_put(skb, sizeof(struct ack_frame));
 				ack_send++;
-				ack_send->id = htonl(NACK);
-				ack_send->offset = htonl(i);
+				ack_send->id = htonl(ecn_ids[j]);
+				ack_send->offset = htonl(qp->ecn_rcv[j]);
 			}
 		}
+		if(qp->fec_rcv){
+			skb_put(skb, sizeof(struct ack_frame));
+			ack_send++;
+			ack_send->id = htonl(FEC_RECOVERED);
+			ack_send->offset = htonl(qp->fec_recovered);
+		}
 		
 		skb_put(skb, sizeof(__be32));
 		ack_send++;
 		end = (__be32 *)(ack_send);
 		*end = htonl(END);
         //END frame at the end of transmission
-		printk("Sending ACK for highest offset %u and %d NACKs\n", qp->highest_rcv, count);
+		printk("Sending ACK for highest offset %u and %d NACKs\n", highest, count);
 		//printk("Delta value = %lu\n", jiffies - qp->highest_rcv_time);
 
         //go to the function which handles actual packet sending
@@ -2179,23 +4488,562 @@ int send_ack(struct sock *sk){
 	}
 	return err;
 }
+
+/*  ACK aggregation: instead of building one ACK per arriving packet from inside quic_queue_rcv_skb(),
+    the socket is put on a per-CPU list and a tasklet is scheduled. The tasklet softirq runs after
+    NET_RX has finished its poll batch, so a single ACK covers every packet received in that batch
+    (same idea as the TCP Small Queues tasklet) */
+struct quic_ack_batch {
+	struct list_head	head;
+	struct tasklet_struct	tasklet;
+};
+static DEFINE_PER_CPU(struct quic_ack_batch, quic_ack_batch);
+
+//called at the end of the softirq batch, with the socket bh-locked and not owned by the user
+static void quic_ack_flush(struct sock *sk){
+	//socket may have been closed while it was waiting on the list
+	if(sk->sk_state != TCP_ESTABLISHED)
+		return;
+	send_ack(sk);
+}
+
+static void quic_ack_batch_handler(unsigned long data){
+	struct quic_ack_batch *batch = (struct quic_ack_batch *)data;
+	LIST_HEAD(list);
+	unsigned long flags;
+	struct list_head *q, *n;
+	struct quic_sock *qp;
+	struct sock *sk;
+
+	local_irq_save(flags);
+	list_splice_init(&batch->head, &list);
+	local_irq_restore(flags);
+
+	list_for_each_safe(q, n, &list) {
+		qp = list_entry(q, struct quic_sock, ack_node);
+		list_del(&qp->ack_node);
+
+		sk = (struct sock *)qp;
+		bh_lock_sock(sk);
+		//packets arriving from now on need a new ACK
+		clear_bit(QUIC_ACK_QUEUED, &qp->ack_flags);
+		if (!sock_owned_by_user(sk)) {
+			quic_ack_flush(sk);
+		} else {
+			/* delegate our work to quic_release_cb() */
+			if (!test_and_set_bit(QUIC_ACK_DEFERRED, &qp->timer_flags))
+				sock_hold(sk);
+		}
+		bh_unlock_sock(sk);
+		sock_put(sk);
+	}
+}
+
+//queue the socket for an ACK at the end of the current softirq batch (at most once per batch)
+static void quic_ack_schedule(struct sock *sk){
+	struct quic_sock *qp = quic_sk(sk);
+	struct quic_ack_batch *batch;
+	unsigned long flags;
+	bool empty;
+
+	if(test_and_set_bit(QUIC_ACK_QUEUED, &qp->ack_flags))
+		return;		//already queued, the pending ACK will cover this packet too
+
+	sock_hold(sk);		//released by quic_ack_batch_handler()
+	local_irq_save(flags);
+	batch = this_cpu_ptr(&quic_ack_batch);
+	empty = list_empty(&batch->head);
+	list_add(&qp->ack_node, &batch->head);
+	if(empty)
+		tasklet_schedule(&batch->tasklet);
+	local_irq_restore(flags);
+}
+
+static void __init quic_ack_batch_init(void){
+	int i;
+
+	for_each_possible_cpu(i) {
+		struct quic_ack_batch *batch = &per_cpu(quic_ack_batch, i);
+
+		INIT_LIST_HEAD(&batch->head);
+		tasklet_init(&batch->tasklet, quic_ack_batch_handler,
+			     (unsigned long)batch);
+	}
+}
+
 /*  sends out ACK for every second packet in normal case, or immediately if recived packet is
     out-of-order. When the first packet is received, timer is set (ACK shall still be sent, even
-    if nothing else is sent!) */
+    if nothing else is sent!). "Sending" an ACK means scheduling it for the end of the softirq batch */
 void possibly_send_ack(struct sock *sk, int instant){
 	struct quic_sock *qp = quic_sk(sk);
 
 	if(instant){ //instant flag = send ACK immediately (received packet is out-of-order)
-		if(timer_pending(&qp->quic_del_ack_timer))
+		if(qp->del_ack_time)
 			quic_clear_del_ack_timer(sk);
-		send_ack(sk);
-	}else if(timer_pending(&qp->quic_del_ack_timer)){
+		quic_ack_schedule(sk);
+	}else if(test_bit(QUIC_ACK_QUEUED, &qp->ack_flags)){
+		//an ACK is already due at the end of this batch, it will cover this packet too
+	}else if(qp->del_ack_time){
 		quic_clear_del_ack_timer(sk);
-		send_ack(sk);
+		quic_ack_schedule(sk);
 	}else{
-		quic_reset_del_ack_timer(sk, QUIC_DEL_ACK);
+		quic_reset_del_ack_timer(sk, qp->local_tp.max_ack_delay);
+	}
+}
+// ****   Address validation: stateless cookies and 0-RTT
+// *****************************************************************************************
+/*  A server that gets more SYNs than it should (or always, with net.quic.syn_cookies = 2)
+    answers a SYN with a RETRY carrying a cookie, sent without touching the socket. The client
+    sends its SYN again with the cookie; only a SYN with a valid cookie, or with a valid 0-RTT
+    token, makes the server build connection state. Cookies are a keyed hash of the addresses,
+    ports, connection ID and the current minute (as TCP's syncookies, with sha_transform, as
+    there is no siphash here), with the minute in the low bits so it can be checked.
+
+    The server also issues the client a token in the SYN reply. A client reconnecting to that
+    server presents it in its SYN and sends data right behind it, without waiting for the reply.
+    The token is the same hash over the client and server addresses only, so it survives
+    client port changes: a valid token shows the client has been reachable at its address. Its
+    low bits are a counter of QUIC_TOKEN_UNIT seconds, and it expires after QUIC_TOKEN_MAX_AGE.
+
+    0-RTT data can be replayed by whoever captured the SYN. The server remembers the connection
+    ID and token of every SYN whose 0-RTT data it took, in two Bloom filters that together span
+    at least the lifetime of a token, and rejects the 0-RTT data of a SYN it has seen before.
+    A false positive only costs a client its 0-RTT */
+
+#define QUIC_COOKIE_BITS	8
+#define QUIC_COOKIE_MASK	((1U << QUIC_COOKIE_BITS) - 1)
+
+//frames of a SYN, each in it at most once
+#define QUIC_SYN_TOKEN		0x1
+#define QUIC_SYN_COOKIE		0x2
+
+static u32 quic_cookie_secret[2][16 - 4 + SHA_DIGEST_WORDS] __read_mostly;
+
+static DEFINE_PER_CPU(__u32 [16 + 5 + SHA_WORKSPACE_WORDS], quic_cookie_scratch);
+
+static u32 quic_cookie_hash(__be32 saddr, __be32 daddr, __be16 sport, __be16 dport,
+			    __be64 conn_id, u32 count, int c){
+	__u32 *tmp;
+
+	net_get_random_once(quic_cookie_secret, sizeof(quic_cookie_secret));
+
+	tmp  = __get_cpu_var(quic_cookie_scratch);
+	memcpy(tmp + 4, quic_cookie_secret[c], sizeof(quic_cookie_secret[c]));
+	tmp[0] = (__force u32)saddr;
+	tmp[1] = (__force u32)daddr;
+	tmp[2] = ((__force u32)sport << 16) + (__force u32)dport;
+	tmp[3] = count;
+	tmp[4] ^= (__force u64)conn_id;
+	tmp[5] ^= (__force u64)conn_id >> 32;
+	sha_transform(tmp + 16, (__u8 *)tmp, tmp + 16 + 5);
+
+	return tmp[17];
+}
+
+static inline u32 quic_cookie_count(void){
+	return jiffies / (60 * HZ);
+}
+
+//cookie for the SYN in skb
+static u32 quic_cookie_gen(const struct sk_buff *skb){
+	const struct quichdr *qh = quic_hdr(skb);
+	u32 count = quic_cookie_count();
+
+	return (quic_cookie_hash(ip_hdr(skb)->saddr, ip_hdr(skb)->daddr, qh->source, qh->dest,
+				 qh->conn_id, count, 0) & ~QUIC_COOKIE_MASK) |
+	       (count & QUIC_COOKIE_MASK);
+}
+
+static bool quic_cookie_check(const struct sk_buff *skb, u32 cookie){
+	const struct quichdr *qh = quic_hdr(skb);
+	u32 count = quic_cookie_count();
+	u32 age = (count - cookie) & QUIC_COOKIE_MASK;
+
+	if(age > QUIC_COOKIE_MAX_AGE)
+		return false;
+	count -= age;
+	return ((quic_cookie_hash(ip_hdr(skb)->saddr, ip_hdr(skb)->daddr, qh->source, qh->dest,
+				  qh->conn_id, count, 0) ^ cookie) & ~QUIC_COOKIE_MASK) == 0;
+}
+
+static inline u32 quic_token_count(void){
+	return jiffies / (QUIC_TOKEN_UNIT * HZ);
+}
+
+static u32 quic_token_gen(__be32 saddr, __be32 daddr, __be16 dport){
+	u32 count = quic_token_count();
+
+	return (quic_cookie_hash(saddr, daddr, 0, dport, 0, count, 1) & ~QUIC_COOKIE_MASK) |
+	       (count & QUIC_COOKIE_MASK);
+}
+
+static bool quic_token_check(__be32 saddr, __be32 daddr, __be16 dport, u32 token){
+	u32 count = quic_token_count();
+	u32 age = (count - token) & QUIC_COOKIE_MASK;
+
+	if(age > QUIC_TOKEN_MAX_AGE)
+		return false;
+	count -= age;
+	return ((quic_cookie_hash(saddr, daddr, 0, dport, 0, count, 1) ^ token) & ~QUIC_COOKIE_MASK) == 0;
+}
+
+static unsigned long quic_zrtt_bloom[2][BITS_TO_LONGS(1 << QUIC_ZRTT_BLOOM_BITS)];
+static u32 quic_zrtt_period;
+static DEFINE_SPINLOCK(quic_zrtt_lock);
+
+//true if the 0-RTT data of this SYN may have been taken already, otherwise it is recorded
+static bool quic_zrtt_replayed(__be64 conn_id, u32 token){
+	u32 period = quic_token_count() / QUIC_TOKEN_MAX_AGE;
+	u32 h1 = hash_64((__force u64)conn_id ^ token, QUIC_ZRTT_BLOOM_BITS);
+	u32 h2 = jhash_3words((__force u64)conn_id, (__force u64)conn_id >> 32, token, 0) &
+		 ((1U << QUIC_ZRTT_BLOOM_BITS) - 1);
+	unsigned long *cur = quic_zrtt_bloom[period & 1];
+	unsigned long *old = quic_zrtt_bloom[!(period & 1)];
+	bool seen;
+
+	spin_lock_bh(&quic_zrtt_lock);
+	//a new period: the filter it reuses only holds tokens which have expired by now
+	if(period != quic_zrtt_period){
+		if(period != quic_zrtt_period + 1)
+			bitmap_zero(old, 1 << QUIC_ZRTT_BLOOM_BITS);
+		bitmap_zero(cur, 1 << QUIC_ZRTT_BLOOM_BITS);
+		quic_zrtt_period = period;
+	}
+	seen = (test_bit(h1, cur) && test_bit(h2, cur)) || (test_bit(h1, old) && test_bit(h2, old));
+	if(!seen){
+		__set_bit(h1, cur);
+		__set_bit(h2, cur);
+	}
+	spin_unlock_bh(&quic_zrtt_lock);
+	return seen;
+}
+
+//the token and the cookie a SYN carries, if any
+static int quic_parse_syn(const struct sk_buff *skb, u32 *token, u32 *cookie){
+	const struct quichdr *qh = quic_hdr(skb);
+	const char *p = (const char *)&qh->type + sizeof(qh->type);
+	const char *end = (const char *)qh + ntohs(qh->len);
+	const struct token_frame *tf;
+	int found = 0, flen;
+
+	//the transport parameters sit between the token and the cookie of a retried SYN
+	for(; p + sizeof(__be32) <= end; p += flen){
+		tf = (const struct token_frame *)p;
+		flen = quic_hs_frame_len(ntohl(tf->id));
+		if(!flen || p + flen > end)
+			break;
+		if(ntohl(tf->id) == TOKEN && !(found & QUIC_SYN_TOKEN)){
+			*token = ntohl(tf->token);
+			found |= QUIC_SYN_TOKEN;
+		}else if(ntohl(tf->id) == COOKIE && !(found & QUIC_SYN_COOKIE)){
+			*cookie = ntohl(tf->token);
+			found |= QUIC_SYN_COOKIE;
+		}
+	}
+	return found;
+}
+
+//ask for a cookie: always, or when this CPU gets more SYNs per second than a server should.
+//The count is per CPU, so a flood spread over the receive queues does not bounce a shared line
+static bool quic_want_cookie(struct sock *sk){
+	struct quic_net *qn = net_generic(sock_net(sk), quic_net_id);
+	struct quic_syn_rate *sr;
+
+	if(!qn->sysctl_syn_cookies)
+		return false;
+	sr = this_cpu_ptr(qn->syn_rate);
+	if(time_after(jiffies, sr->stamp + HZ)){
+		sr->stamp = jiffies;
+		sr->count = 0;
+	}
+	if(++sr->count > QUIC_SYN_FLOOD_RATE)
+		return true;
+	return qn->sysctl_syn_cookies == 2;
+}
+
+/*  Sends a control packet (RETRY, path validation) to any address, with its own route and
+    without the send queue: the socket is neither connected nor changed */
+static void quic_send_ctl(struct sock *sk, __be32 saddr, __be16 sport, __be32 daddr, __be16 dport,
+			  __be64 conn_id, bool cid, u32 type, const void *data, int dlen){
+	struct quichdr *rqh;
+	struct sk_buff *rep;
+	struct flowi4 fl4;
+	struct rtable *rt;
+	int len = sizeof(struct quichdr) + dlen;
+	int hlen = MAX_HEADER + sizeof(struct iphdr);
+	int prot;
+
+	rt = ip_route_output_ports(sock_net(sk), &fl4, sk, daddr, saddr, dport, sport,
+				   IPPROTO_QUIC, RT_CONN_FLAGS(sk), sk->sk_bound_dev_if);
+	if(IS_ERR(rt))
+		return;
+	rep = alloc_skb(hlen + len + QUIC_AEAD_OVERHEAD, GFP_ATOMIC);
+	if(!rep){
+		ip_rt_put(rt);
+		return;
+	}
+	skb_reserve(rep, hlen);
+	rqh = (struct quichdr *)skb_put(rep, len);
+	skb_reset_transport_header(rep);
+	memset(rqh, 0, sizeof(struct quichdr));
+	rqh->source = sport;
+	rqh->dest = dport;
+	rqh->len = htons(len);
+	rqh->cid = cid;
+	rqh->conn_id = conn_id;
+	rqh->type = htonl(type);
+	memcpy(rqh + 1, data, dlen);
+	prot = quic_aead_seal(sk, rqh, dlen);
+	if(prot < 0){
+		kfree_skb(rep);
+		ip_rt_put(rt);
+		return;
+	}
+	skb_put(rep, prot);
+	len += prot;
+	rqh->len = htons(len);
+	rqh->check = csum_tcpudp_magic(fl4.saddr, fl4.daddr, len, IPPROTO_QUIC,
+				       csum_partial(rqh, len, 0));
+	if(rqh->check == 0)
+		rqh->check = CSUM_MANGLED_0;
+	skb_dst_set(rep, &rt->dst);
+	ip_build_and_send_pkt(rep, sk, fl4.saddr, fl4.daddr, NULL);
+}
+
+//stateless reply to the SYN in skb
+static void quic_send_retry(struct sock *sk, struct sk_buff *skb){
+	const struct quichdr *qh = quic_hdr(skb);
+	struct token_frame cf;
+
+	cf.id = htonl(COOKIE);
+	cf.token = htonl(quic_cookie_gen(skb));
+	printk("Sending retry to %pI4:%u\n", &ip_hdr(skb)->saddr, ntohs(qh->source));
+	quic_send_ctl(sk, ip_hdr(skb)->daddr, qh->dest, ip_hdr(skb)->saddr, qh->source,
+		      qh->conn_id, 1, RETRY, &cf, sizeof(cf));
+}
+
+/*  First look at a SYN to a socket waiting for connections, on the CPU that received it and
+    without the socket lock or any write to the socket: a SYN without a valid token or cookie
+    is answered with a RETRY while the server is loaded, and dropped. Only SYNs of clients
+    that showed they own their address reach quic_reply_connect() and build state there.
+    Returns true if the skb was consumed */
+static bool quic_syn_rcv_lockless(struct sock *sk, struct sk_buff *skb){
+	struct quichdr *qh = quic_hdr(skb);
+	u32 syn_token = 0, syn_cookie = 0;
+	int found;
+
+	if(ACCESS_ONCE(sk->sk_state) != TCP_CLOSE || !qh->cid || ntohl(qh->type) != SYN)
+		return false;
+	if(!pskb_may_pull(skb, ntohs(qh->len)) ||
+	   !xfrm4_policy_check(sk, XFRM_POLICY_IN, skb))
+		return false;		//the usual path drops it
+	qh = quic_hdr(skb);
+	found = quic_parse_syn(skb, &syn_token, &syn_cookie);
+	if((found & QUIC_SYN_TOKEN) &&
+	   quic_token_check(ip_hdr(skb)->saddr, ip_hdr(skb)->daddr, qh->dest, syn_token))
+		return false;
+	if((found & QUIC_SYN_COOKIE) && quic_cookie_check(skb, syn_cookie))
+		return false;
+	if(!quic_want_cookie(sk))
+		return false;
+	quic_send_retry(sk, skb);
+	consume_skb(skb);
+	return true;
+}
+
+//client: the server asked for a cookie, send the SYN again with it (once per connection)
+static void quic_retry_connect(struct sock *sk, struct sk_buff *skb){
+	struct quic_sock *qp = quic_sk(sk);
+	struct quichdr *qh = quic_hdr(skb);
+	struct token_frame *cf = (struct token_frame *)((char *)&qh->type + sizeof(qh->type));
+	struct sk_buff *syn = skb_peek(&sk->sk_write_queue);
+	struct token_frame *sf;
+
+	if(qp->syn_cookie || qp->conn_id != qh->conn_id || !syn ||
+	   (char *)(cf + 1) > (char *)qh + ntohs(qh->len) || ntohl(cf->id) != COOKIE)
+		return;
+	if(skb_tailroom(syn) < sizeof(struct token_frame))
+		return;
+	qp->syn_cookie = ntohl(cf->token);
+	sf = (struct token_frame *)skb_put(syn, sizeof(struct token_frame));
+	sf->id = htonl(COOKIE);
+	sf->token = cf->token;
+	qp->bytes_in_flight += sizeof(struct token_frame);	//the SYN is in flight and grew
+	printk("Retry received, sending SYN with cookie\n");
+	if(!quic_finish_send_skb(syn, 1, 1))
+		qp->last_sent_time = QUIC_SKB_CB(syn)->timestamp;
+	qp->pto_count = 0;
+	quic_set_loss_detection_timer(sk);
+}
+
+//client: the server did not take the 0-RTT data, send it again as normal data right away
+static void quic_zero_rtt_rejected(struct sock *sk){
+	struct quic_sock *qp = quic_sk(sk);
+	struct quic_skb_cb *qb;
+	struct sk_buff *skb;
+	bool sent = !IS_ERR_OR_NULL(qp->last_sent);
+
+	skb_queue_walk(&sk->sk_write_queue, skb) {
+		if(ntohl(quic_hdr(skb)->type) != DATA_0RTT)
+			goto next;
+		quic_hdr(skb)->type = htonl(DATA);
+		qb = QUIC_SKB_CB(skb);
+		if(sent && !(qb->flags & QUIC_PKT_LOST)){
+			qb->flags |= QUIC_PKT_LOST;
+			qp->lost_out++;
+			if(qp->packets_out)
+				qp->packets_out--;
+			qp->bytes_in_flight -= min(skb->len, qp->bytes_in_flight);
+		}
+next:
+		if(skb == qp->last_sent)
+			sent = false;
+	}
+	printk("0-RTT data rejected by the server, %u packets to send again\n", qp->lost_out);
+}
+
+// ****   Connection migration
+// *****************************************************************************************
+/*  (RFC 9000 section 9) Connections are found by connection ID when the peer's address changed.
+    A packet of an established connection from a new address is processed as usual, but the
+    connection only moves there once the new address answered a PATH_CHALLENGE with a
+    PATH_RESPONSE, so a spoofed address cannot redirect it. Moving means a new route through
+    ip4_datagram_connect() and, unless only the port changed (NAT rebinding), starting over with
+    congestion control and RTT, seeded from the metrics cache of the new address. A client moves
+    by itself when its route is gone, or when asked with the QUIC_MIGRATE socket option */
+
+//the new path is another one: forget what was learned about the old path
+static void quic_path_reset(struct sock *sk){
+	struct quic_sock *qp = quic_sk(sk);
+	struct quic_net *qn = net_generic(sock_net(sk), quic_net_id);
+
+	qp->rto = USEC_PER_SEC;
+	qp->srtt = (20 * USEC_PER_MSEC)<<3;
+	qp->rttvar = qp->mdev = qp->mdev_max = 0;
+	qp->first_rtt = 1;
+	qp->latest_rtt = 0;
+	qp->min_rtt = ~0U;
+	qp->pto_count = 0;
+
+	//congestion control starts again with the next ACK
+	if(!qp->first_ack && qp->ca_ops->release)
+		qp->ca_ops->release(sk);
+	qp->first_ack = 1;
+	qp->ca_state = QUIC_CA_Open;
+	qp->prr_target = 0;
+	qp->undo_marker = 0;
+	qp->cwnd = qn->sysctl_init_cwnd * QUIC_MSS;
+	qp->cwnd_cnt = 0;
+	qp->ssthresh = UINT_MAX;
+	qp->app_limited = 0;
+	qp->rate_max = 0;
+	quic_init_metrics(sk);
+}
+
+//connect the socket to its (new) peer address, with a new route; the source address is kept
+static int quic_path_connect(struct sock *sk, __be32 daddr, __be16 dport){
+	struct sockaddr_in peer;
+
+	peer.sin_family = AF_INET;
+	peer.sin_port = dport;
+	peer.sin_addr.s_addr = daddr;
+	return ip4_datagram_connect(sk, (struct sockaddr *)&peer, sizeof(peer));
+}
+
+//client: move the connection to the current route to the peer, and the source address of it
+static int quic_migrate(struct sock *sk){
+	struct quic_sock *qp = quic_sk(sk);
+	struct inet_sock *inet = inet_sk(sk);
+	__be32 saddr = inet->inet_saddr, rcv_saddr = inet->inet_rcv_saddr;
+	int err;
+
+	if(sk->sk_state != TCP_ESTABLISHED)
+		return -ENOTCONN;
+	if(!rcu_access_pointer(qp->aead_tx))	//the peer would not validate the new address
+		return -EPERM;
+	if(sk->sk_userlocks & SOCK_BINDADDR_LOCK)	//bound to an address by the application
+		return -EINVAL;
+
+	inet->inet_saddr = inet->inet_rcv_saddr = 0;
+	err = quic_path_connect(sk, inet->inet_daddr, inet->inet_dport);
+	if(err){
+		inet->inet_saddr = saddr;
+		inet->inet_rcv_saddr = rcv_saddr;
+		return err;
+	}
+	if(inet->inet_saddr == saddr)
+		return 0;
+	printk("Migrating from %pI4 to %pI4\n", &saddr, &inet->inet_saddr);
+	quic_path_reset(sk);
+	//show the peer the new address right away
+	possibly_send_ack(sk, 1);
+	if(!qp->sending)
+		try_send_packets(sk);
+	return 0;
+}
+
+/*  A packet of the connection came from another address: validate it, one address at a time.
+    Without packet protection the connection ID, which anyone on the path sees, is all that ties
+    the packet to the peer, so the connection does not move then */
+static void quic_path_probe(struct sock *sk, struct sk_buff *skb, bool mpath){
+	struct quic_sock *qp = quic_sk(sk);
+	struct inet_sock *inet = inet_sk(sk);
+	struct quichdr *qh = quic_hdr(skb);
+
+	if(!rcu_access_pointer(qp->aead_rx)){
+		printk("QUIC: packet from %pI4:%u ignored, no migration without packet protection\n",
+		       &ip_hdr(skb)->saddr, ntohs(qh->source));
+		return;
+	}
+	if(qp->path_daddr &&
+	   (s32)(QUIC_TIMESTAMP - qp->path_challenge_time) < (s32)(3 * quic_pto(qp)))
+		return;		//validation running
+	qp->path_daddr = ip_hdr(skb)->saddr;
+	qp->path_dport = qh->source;
+	qp->path_mpath = mpath;
+	get_random_bytes(&qp->path_challenge, sizeof(qp->path_challenge));
+	qp->path_challenge_time = QUIC_TIMESTAMP;
+	printk("Peer address changed to %pI4:%u, validating\n", &qp->path_daddr, ntohs(qp->path_dport));
+	quic_send_ctl(sk, inet->inet_saddr, inet->inet_sport, qp->path_daddr, qp->path_dport,
+		      qp->conn_id, 0, PATH_CHALLENGE, &qp->path_challenge, sizeof(qp->path_challenge));
+}
+
+//PATH_CHALLENGE or PATH_RESPONSE: answer a challenge from where it came, move on a matching response
+static void quic_path_rcv(struct sock *sk, struct sk_buff *skb){
+	struct quic_sock *qp = quic_sk(sk);
+	struct quichdr *qh = quic_hdr(skb);
+	__be64 *data = (__be64 *)((char *)&qh->type + sizeof(qh->type));
+	bool moved;
+
+	if((char *)(data + 1) > (char *)qh + ntohs(qh->len))
+		return;
+	if(ntohl(qh->type) == PATH_CHALLENGE){
+		quic_send_ctl(sk, ip_hdr(skb)->daddr, qh->dest, ip_hdr(skb)->saddr, qh->source,
+			      qp->conn_id, 0, PATH_RESPONSE, data, sizeof(*data));
+		return;
+	}
+	if(!qp->path_daddr || *data != qp->path_challenge ||
+	   ip_hdr(skb)->saddr != qp->path_daddr || qh->source != qp->path_dport)
+		return;
+	if(qp->path_mpath){
+		printk("Path to %pI4:%u validated, sending over it too\n", &qp->path_daddr, ntohs(qp->path_dport));
+		quic_mpath_add(sk, ip_hdr(skb)->daddr, qp->path_daddr, qp->path_dport);
+		qp->path_daddr = 0;
+		return;
+	}
+	moved = qp->path_daddr != inet_sk(sk)->inet_daddr;
+	if(quic_path_connect(sk, qp->path_daddr, qp->path_dport)){
+		printk("No route to the new peer address %pI4\n", &qp->path_daddr);
+		return;
 	}
+	printk("Path to %pI4:%u validated, connection moved\n", &qp->path_daddr, ntohs(qp->path_dport));
+	qp->path_daddr = 0;
+	if(moved)
+		quic_path_reset(sk);
+	if(!qp->sending)
+		try_send_packets(sk);
 }
+
 /*  CONNECTION ESTABLISHMENT - This function creates a hello packet and sets the socket state to
     "TCP_SYN_SENT" (you know what it should mean - nothing else to do with TCP)  */
 
@@ -2209,6 +5057,8 @@ int quic_send_connect(struct sock *sk, struct sockaddr *uaddr){
 	struct inet_sock *inet = inet_sk(sk);
 	struct flowi4 *fl4 = &inet->cork.fl.u.ip4;
 	//struct quic_skb_cb *qcb;
+	struct token_frame *tf;
+	u32 token;
 	int err = 0;
 
 //create new socket buffer
@@ -2227,10 +5077,20 @@ int quic_send_connect(struct sock *sk, struct sockaddr *uaddr){
 		//qb->offset = qb->sequence = qp->send_next++;
 		qb->offset = qp->send_next++;
 		qb->cid =1;
-		qb->type = htonl(SYN);
-		qb->missing_reports = 0;
+		qh->type = htonl(SYN);
+		qb->flags = 0;
+		quic_init_metrics(sk);
+		//known server: present its token, data may follow before the reply (0-RTT)
+		qp->zero_rtt = quic_token_lookup(sk, &token);
+		if(qp->zero_rtt){
+			tf = (struct token_frame *)skb_put(skb, sizeof(struct token_frame));
+			tf->id = htonl(TOKEN);
+			tf->token = htonl(token);
+			printk("Presenting token for 0-RTT\n");
+		}
+		quic_tp_put(sk, skb);
 
-		qp->conn_id = 420;
+		get_random_bytes(&qp->conn_id, sizeof(qp->conn_id));	//identifies the connection across address changes
 //especially: set QUIC socket state
 		sk->sk_state = TCP_SYN_SENT;
 		printk("Set the QUIC socket state to TCP_SYN_SENT\n");
@@ -2242,13 +5102,117 @@ int quic_send_connect(struct sock *sk, struct sockaddr *uaddr){
 		}
 
 	}
-//set up the handshake timer (here, during connection establishment)
-	quic_reset_hshake_loss_timer(sk, 1.5*((qp->srtt)>>3));
+//set up the loss detection timer (here, during connection establishment it is a PTO for the hello)
+	if(!err){
+		qp->last_sent_time = QUIC_SKB_CB(skb)->timestamp;
+		quic_set_loss_detection_timer(sk);
+	}
 	//sk_reset_timer(sk, &qp->quic_hshake_timer, (jiffies + (1.5*qp->rto)));
 
 	return err;                      
                                          
 }
+/*  User-space handshake (kTLS-like): with QUIC_HANDSHAKE_USER, SYN, SYN_REP and RETRY packets
+    are neither built nor answered by the kernel. They are queued to the socket and read with
+    recvmsg() (cmsg QUIC_HANDSHAKE), and a daemon sends its own with sendmsg() and the same cmsg.
+    The daemon negotiates keys and parameters, then installs the connection with QUIC_ESTABLISH
+    and QUIC_CRYPTO: from there on the data path is the kernel's */
+
+//handshake packet to the receive queue of the socket, for recvmsg()
+static int quic_hs_deliver(struct sock *sk, struct sk_buff *skb){
+	printk("Handshake packet type %u from %pI4:%u to user space\n", ntohl(quic_hdr(skb)->type),
+	       &ip_hdr(skb)->saddr, ntohs(quic_hdr(skb)->source));
+	ipv4_pktinfo_prepare(sk, skb);
+	return __udp_queue_rcv_skb(sk, skb);
+}
+
+//QUIC_HANDSHAKE control message of a sendmsg(), if any
+static bool quic_hs_cmsg(struct msghdr *msg, struct quic_handshake_msg *hm){
+	struct cmsghdr *cmsg;
+
+	for (cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+		if (!CMSG_OK(msg, cmsg))
+			return false;
+		if (cmsg->cmsg_level != SOL_QUIC || cmsg->cmsg_type != QUIC_HANDSHAKE)
+			continue;
+		if (cmsg->cmsg_len < CMSG_LEN(sizeof(*hm)))
+			return false;
+		memcpy(hm, CMSG_DATA(cmsg), sizeof(*hm));
+		return true;
+	}
+	return false;
+}
+
+/*  Handshake packet of the daemon: sent at once and in clear, outside the send queue, to the
+    address of the message or to the peer. Retransmission is up to the daemon */
+static int quic_hs_sendmsg(struct sock *sk, struct msghdr *msg, size_t len,
+			   const struct quic_handshake_msg *hm){
+	struct inet_sock *inet = inet_sk(sk);
+	struct sockaddr_in *usin = (struct sockaddr_in *)msg->msg_name;
+	__be32 daddr = inet->inet_daddr;
+	__be16 dport = inet->inet_dport;
+	u8 *data;
+	int err;
+
+	if(hm->type != SYN && hm->type != SYN_REP && hm->type != RETRY)
+		return -EINVAL;
+	if(len > QUIC_HS_MAX_LEN)
+		return -EMSGSIZE;
+	if(usin){
+		if(msg->msg_namelen < sizeof(*usin))
+			return -EINVAL;
+		if(usin->sin_family != AF_INET)
+			return -EAFNOSUPPORT;
+		daddr = usin->sin_addr.s_addr;
+		dport = usin->sin_port;
+	}
+	if(!daddr || !dport)
+		return -EDESTADDRREQ;
+	data = kmalloc(len ? len : 1, GFP_KERNEL);
+	if(!data)
+		return -ENOMEM;
+	err = memcpy_fromiovec(data, msg->msg_iov, len);
+	if(!err)
+		quic_send_ctl(sk, inet->inet_saddr, inet->inet_sport, daddr, dport,
+			      hm->conn_id, 1, hm->type, data, len);
+	kfree(data);
+	return err ? err : len;
+}
+
+/*  The daemon finished the handshake: the socket takes the peer and connection ID it agreed on.
+    Packet number 0 of both directions was the handshake, data starts at 1 */
+static int quic_hs_establish(struct sock *sk, const struct quic_handshake_info *info){
+	struct quic_sock *qp = quic_sk(sk);
+	int err;
+
+	if(info->peer.sin_family != AF_INET)
+		return -EAFNOSUPPORT;
+	lock_sock(sk);
+	if(!qp->hs_user || sk->sk_state == TCP_ESTABLISHED){
+		release_sock(sk);
+		return -EINVAL;
+	}
+	err = __ip4_datagram_connect(sk, (struct sockaddr *)&info->peer, sizeof(info->peer));
+	if(!err){
+		qp->conn_id = info->conn_id;
+		qp->first_unack = qp->send_next = 1;
+		qp->highest_rcv = 0;
+		qp->rcv_next = 1;
+		qp->server = !!info->server;
+		qp->syn_acked = 1;	//no SYN reply of the kernel in the write queue
+		quic_init_metrics(sk);
+		quic_tp_apply(sk, &info->params);
+		sk->sk_state = TCP_ESTABLISHED;
+		quic_cid_hash_add(sk);
+		printk("Connection %llx established by user space\n", info->conn_id);
+	}else
+		sk->sk_state = TCP_CLOSE;
+	release_sock(sk);
+	if(!err)
+		sk->sk_state_change(sk);	//wake up senders waiting for the handshake
+	return err;
+}
+
 /* function pointer: this is the connect call in the quic_prot structure */
 int quic_datagram_connect(struct sock *sk, struct sockaddr *uaddr, int addr_len)
 {
@@ -2256,7 +5220,12 @@ int quic_datagram_connect(struct sock *sk, struct sockaddr *uaddr, int addr_len)
 //protection from parallel uncontrolled access
 	lock_sock(sk);
 	res = __ip4_datagram_connect(sk, uaddr, addr_len);
+	//the daemon sends the SYN
+	if(!res && quic_sk(sk)->hs_user)
+		sk->sk_state = TCP_SYN_SENT;
 	release_sock(sk);
+	if(quic_sk(sk)->hs_user)
+		return res;
 	//Plug-in QUIC connection establishment
 	printk(" QUIC connection initiated....\n");
 	res = quic_send_connect(sk, uaddr);
@@ -2277,6 +5246,15 @@ int quic_reply_connect(struct sock *sk, struct sk_buff *skb){
     when the SYN queue fills up */
 	struct syn_cookie_headless *cookie;
 	struct ack_frame *ack;
+	struct token_frame *tf;
+	struct quic_net *qn = net_generic(sock_net(sk), quic_net_id);
+	u32 token = quic_token_gen(ip_hdr(skb)->saddr, ip_hdr(skb)->daddr, qh->dest);
+	u32 syn_token = 0, syn_cookie = 0;
+	//address validation (cookies) is done before, in quic_syn_rcv_lockless()
+	bool presented = quic_parse_syn(skb, &syn_token, &syn_cookie) & QUIC_SYN_TOKEN;
+	bool validated = presented &&
+			 quic_token_check(ip_hdr(skb)->saddr, ip_hdr(skb)->daddr, qh->dest, syn_token);
+	struct quic_transport_params tp;
 
 	printk("Replying to connection request from %pI4:%d with sequence number %u\n", &(ip_hdr(skb)->saddr), ntohs(qh->source), qh->offset);
 	
@@ -2299,12 +5277,21 @@ int quic_reply_connect(struct sock *sk, struct sk_buff *skb){
 
 	qp->rcv_next = qp->highest_rcv + 1;
 	qp->conn_id = qh->conn_id;
+	if(quic_tp_parse(qh, (char *)&qh->type + sizeof(qh->type), &tp))
+		quic_tp_apply(sk, &tp);
+	//a SYN with a valid token: the 0-RTT data behind it is accepted
+	if(presented){
+		qp->zero_rtt = qn->sysctl_zero_rtt && validated && !quic_zrtt_replayed(qh->conn_id, syn_token);
+		printk("Token presented, 0-RTT %s\n", qp->zero_rtt ? "accepted" : "rejected");
+	}
 //ipv4 connection is set up -> route calculation and so on
 	err = ip4_datagram_connect(sk, (struct sockaddr *) &replyaddr, sizeof(replyaddr));
 	if(err){
 		printk("Error finding a route to %pI4:%d\n", &(ip_hdr(skb)->saddr), 
 					ntohs(qh->source));
 		printk("ip4_datagram_connect returned error code %d\n", err);
+	}else{
+		quic_init_metrics(sk);
 	}
 //create new socket buffer
 	skb_rep = quic_ip_make_skb(sk, fl4, 500);
@@ -2324,21 +5311,29 @@ int quic_reply_connect(struct sock *sk, struct sk_buff *skb){
 		qb->offset = qp->send_next++;
 		//create cookie for security reasons
 		cookie = (struct syn_cookie_headless *)skb_put(skb_rep, sizeof(struct syn_cookie_headless));
-		qb->type = htonl(SYN_REP);
-		qb->missing_reports = 0;
-		cookie->cookie = htonl(8182);
-		//printk("Addresses\ntype = %p\ncook = %p\n", &qb->type, &cookie->cookie);
+		quic_hdr(skb_rep)->type = htonl(SYN_REP);
+		qb->flags = 0;
+		cookie->cookie = htonl(quic_cookie_gen(skb));
+		//printk("Addresses\ntype = %p\ncook = %p\n", &quic_hdr(skb_rep)->type, &cookie->cookie);
         //frame in socket buffer is an ACK frame
 		// Change the ACK sending behaviour
 		ack = (struct ack_frame *)skb_put(skb_rep, sizeof(struct ack_frame));
 		ack->id = htonl(ACK);
 		ack->offset = htonl(qp->highest_rcv);
+		//token for the next connection of this client
+		tf = (struct token_frame *)skb_put(skb_rep, sizeof(struct token_frame));
+		tf->id = htonl(TOKEN);
+		tf->token = htonl(token);
+		if(presented && !qp->zero_rtt)
+			*(__be32 *)skb_put(skb_rep, sizeof(__be32)) = htonl(ZRTT_REJECT);
+		quic_tp_put(sk, skb_rep);
 //actual sending
 		err = quic_finish_send_skb(skb_rep, 1, 0);
 		if(!err){
 //if no error, change the socket state: connection has been established
 			sk->sk_state = TCP_ESTABLISHED;
 			printk("Set the QUIC socket state to TCP_ESTABLISHED after sending Hello reply\n");
+			quic_cid_hash_add(sk);
 		}
 		qp->syn_acked = 0;	//Syn Reply not Acked yet
 		qp->server = 1;
@@ -2355,14 +5350,21 @@ int quic_reply_accept(struct sock *sk, struct sk_buff *skb){
 	char *ptr = (char *)&qh->type;
 	struct syn_cookie *cookie;
 	struct ack_frame *ack;
+	struct token_frame *tf;
+	char *end = (char *)qh + ntohs(qh->len);
+	bool rejected = false;
+	struct quic_ack_sample rs;
+	struct sk_buff_head acked;
+	struct quic_transport_params tp;
 
 
 	printk("Received Hello reply with sequence %u\n", qh->offset);
 	if(qp->conn_id == qh->conn_id){ //verify - is it the right connection?
 		sk->sk_state = TCP_ESTABLISHED; //set client's socket state to TCP_ESTABLISHED
 		printk("Set the QUIC socket state to TCP_ESTABLISHED\n");
-//handshake timer not needed anymore!
-		quic_clear_hshake_loss_timer(sk);
+		quic_cid_hash_add(sk);
+//hello PTO not needed anymore!
+		quic_clear_loss_detection_timer(sk);
 //send back the same cookie (avoids SYN flooding)
 		cookie = (struct syn_cookie *)ptr;
 		qp->syn_cookie = ntohl(cookie->cookie);
@@ -2371,7 +5373,25 @@ int quic_reply_accept(struct sock *sk, struct sk_buff *skb){
 
 		if(qp->highest_ack < ack->offset)
 			qp->highest_ack = ack->offset;
-		delete_acked(sk);
+		if(quic_tp_parse(qh, (char *)ack, &tp))
+			quic_tp_apply(sk, &tp);
+		__skb_queue_head_init(&acked);
+		quic_clean_rtx_queue(sk, NULL, 0, &rs, &acked);
+//keep the token for 0-RTT on the next connection to this server
+		tf = (struct token_frame *)(ack + 1);
+		if((char *)(tf + 1) <= end && ntohl(tf->id) == TOKEN){
+			quic_token_store(sk, ntohl(tf->token));
+			rejected = (char *)(tf + 1) + sizeof(__be32) <= end &&
+				   ntohl(*(__be32 *)(tf + 1)) == ZRTT_REJECT;
+		}else if(qp->zero_rtt){
+			quic_token_store(sk, 0);	//server does not issue tokens anymore
+			rejected = true;
+		}
+		if(qp->zero_rtt && rejected)
+			quic_zero_rtt_rejected(sk);
+		qp->zero_rtt = 0;
+		quic_set_loss_detection_timer(sk);
+		__skb_queue_purge(&acked);
 //read parameter from socket header
 		qb = QUIC_SKB_CB(skb);
 		if(qp->highest_rcv < qh->offset){
@@ -2509,8 +5529,35 @@ int quic_queue_rcv_skb(struct sock *sk, struct sk_buff *skb)
 	qh = quic_hdr(skb);
 	qb = QUIC_SKB_CB(skb);
 	ptr = (char *)&qh->type;
+	//handshake packets of a daemon, in any state
+	if(qp->hs_user && qh->cid && quic_is_handshake(qh))
+		return quic_hs_deliver(sk, skb);
 	switch (sk->sk_state) {
 	case TCP_ESTABLISHED: //in case a connection has already been established
+		if(ntohl(qh->type) == PATH_CHALLENGE || ntohl(qh->type) == PATH_RESPONSE){
+			quic_path_rcv(sk, skb);
+			goto drop;
+		}
+		//packet from another address than the peer's: the peer may have moved, or added a path.
+		//Until the address is validated it only gets a PATH_CHALLENGE, its frames are ignored
+		if(ip_hdr(skb)->saddr != inet_sk(sk)->inet_daddr || qh->source != inet_sk(sk)->inet_dport){
+			if(!qh->mpath){
+				quic_path_probe(sk, skb, 0);
+				goto drop;
+			}
+			if(!quic_mpath_find(qp, ip_hdr(skb)->daddr, ip_hdr(skb)->saddr, qh->source)){
+				quic_path_probe(sk, skb, 1);
+				goto drop;
+			}
+		}
+		//repair packet: the data packet it rebuilt, if any, is received first, then it takes its
+		//own place among the packet numbers without being delivered
+		if(ntohl(qh->type) == FEC){
+			struct sk_buff *nskb = quic_fec_recover(sk, skb);
+
+			if(nskb)
+				quic_queue_rcv_skb(sk, nskb);
+		}
 		if(qh->cid){ //if the header carries a connection ID
 			if(ntohl(qh->type) == SYN){
 				if(qp->syn_acked){
@@ -2537,8 +5584,11 @@ int quic_queue_rcv_skb(struct sock *sk, struct sk_buff *skb)
 				printk("QUIC: Improper SYN request/reply from %pI4:%u\n", &ip_hdr(skb)->saddr, ntohs(qh->source));
 			goto drop;
 			//a data packet has been received
-		}else if(ntohl(qh->type) == DATA){
+		//0-RTT data only if the token of the SYN was valid, it does not confirm the SYN reply
+		}else if(ntohl(qh->type) == DATA || ntohl(qh->type) == FEC ||
+			 (ntohl(qh->type) == DATA_0RTT && qp->zero_rtt)){
 			printk("**************\nReceived Data packet\n");
+			quic_ecn_rcv(qp, skb);
             //in-order reception: new highest packet number
 			if(qp->highest_rcv < qh->offset){
 				printk("New highest received packet number %u, sequence = %u\n", qh->offset, qh->sequence);
@@ -2553,15 +5603,25 @@ int quic_queue_rcv_skb(struct sock *sk, struct sk_buff *skb)
 					qp->highest_rcv_time = qb->timestamp;
 				}
 			}
-			if(qp->syn_acked == 0){
+			if(qp->fec_rcv && ntohl(qh->type) == DATA)
+				quic_fec_rcv(qp, skb);
+			if(qp->syn_acked == 0 && ntohl(qh->type) == DATA){
 				qp->syn_acked = 1; //the SYN reply has been surely ACKed, if we're already at this stage
 				if(qp->server){ //if this socket is the server
-					quic_clear_rto_tlp_timer(sk);
-					quic_clear_hshake_loss_timer(sk);
-//take head of the write queue away and free it
+					quic_clear_loss_detection_timer(sk);
+//take the SYN reply away from the head of the write queue, unless an ACK did already, and free it
 					skb_temp = skb_peek(&sk->sk_write_queue);
-					skb_unlink(skb_temp, &sk->sk_write_queue);
-					kfree_skb(skb_temp);
+					if(skb_temp && ntohl(quic_hdr(skb_temp)->type) == SYN_REP){
+						if(skb_temp == qp->last_sent)
+							qp->last_sent = NULL;
+						skb_unlink(skb_temp, &sk->sk_write_queue);
+						if(qp->packets_out)
+							qp->packets_out--;
+						qp->bytes_in_flight -= min(skb_temp->len, qp->bytes_in_flight);
+						kfree_skb(skb_temp);
+					}
+					//the PTO goes on for the data sent meanwhile
+					quic_set_loss_detection_timer(sk);
 				}
 			}
 
@@ -2572,28 +5632,13 @@ int quic_queue_rcv_skb(struct sock *sk, struct sk_buff *skb)
 			if(qp->first_ack){
 			//whole congestion control procedure is started
 			//but beware -> no updates for retransmissions (or?)
-				bictcp_init(sk);
+				quic_init_congestion_control(sk);
 				qp->first_ack = 0;
 			}
 			printk("**************\nReceived ACK packet with highest offset %u\n", ntohl(ack->offset)); //process ACK
 			process_ack(sk, skb, ack);
 			printk("Packets out after ACK processing = %u\n", qp->packets_out);
-			if(qp->nacked_in_q){
-				if(!timer_pending(&qp->quic_hshake_loss_timer)){
-					quic_reset_hshake_loss_timer(sk, 0.25*((qp->srtt)>>3));
-					//not ACKed packet -> set LOSS timer
-					printk("Set Loss timer for Fast retransmit at %lu\n", jiffies);
-				}
-				//retransmit_nacked(sk, RESEND_THRESHOLD);
-				if(!IS_ERR_OR_NULL(qp->last_sent)){
-					if(qp->highest_ack == (QUIC_SKB_CB(qp->last_sent))->offset){
-						//Set Early retransmit timer
-						quic_reset_early_retrans_timer(sk, 0.255*(qp->srtt >>3));
-					}
-				}else{ //not ACKed, corrupt packets in queue
-					printk("Error: Nacked packets present in Q but corrupt qp->last_sent\n");
-				}
-			} //if it isn't already sending something else
+			//lost packets are retransmitted first, then new data fills the window
 			if(!qp->sending){
 				try_send_packets(sk);
 			}else{
@@ -2615,6 +5660,10 @@ int quic_queue_rcv_skb(struct sock *sk, struct sk_buff *skb)
 			if(ntohl(qh->type) == SYN_REP){
 				printk("SYN Reply received\n");
 				quic_reply_accept(sk, skb); //send (another) reply accept packet
+				if(!qp->sending)
+					try_send_packets(sk);	//rejected 0-RTT data and data queued meanwhile
+			}else if(ntohl(qh->type) == RETRY){
+				quic_retry_connect(sk, skb);
 			}else
 				printk("QUIC: Improper SYN reply from %pI4:%u\n", &ip_hdr(skb)->saddr, ntohs(qh->source));
 		}
@@ -2646,8 +5695,8 @@ int quic_queue_rcv_skb(struct sock *sk, struct sk_buff *skb)
 		possibly_send_ack(sk, 0);
 	}else{
 		//Out of order packet received
-		//Instantly send ACK
-		possibly_send_ack(sk, 1); //1 -> immediately
+		//Instantly send ACK, unless a repair packet may still fill the gap
+		possibly_send_ack(sk, !qp->fec_rcv); //1 -> immediately
 	}
 
 	rc = 0;
@@ -2658,6 +5707,10 @@ int quic_queue_rcv_skb(struct sock *sk, struct sk_buff *skb)
 			break;
 		qh = quic_hdr(skb);
 
+		//a repair packet lost right before the next data packet is not waited for
+		if(qh->offset == qp->rcv_next + 1 && qh->rep && ntohl(qh->type) == DATA)
+			qp->rcv_next++;
+
 		//Check if this is the packet to be received
 		if(qh->offset != qp->rcv_next){
 			printk("First packet in the read window not yet received\nFirst packet seq %u\nExpected packet seq %u\n", qh->offset, qp->rcv_next);
@@ -2666,6 +5719,13 @@ int quic_queue_rcv_skb(struct sock *sk, struct sk_buff *skb)
 //take current buffer away from receive queue
 		skb_unlink(skb, &sk->quic_receive_queue);
 
+		//a repair packet only holds its packet number
+		if(ntohl(qh->type) == FEC){
+			consume_skb(skb);
+			qp->rcv_next++;
+			continue;
+		}
+
 		if(skb == NULL)
 			continue;
 
@@ -2713,9 +5773,9 @@ int __quic4_lib_rcv(struct sk_buff *skb, struct udp_table *udptable,
 	struct quic_skb_cb *qb;
 
 
-	//Timestamp the packet
+	//Timestamp the packet (us)
 	qb = QUIC_SKB_CB(skb);
-	qb->timestamp = jiffies;
+	qb->timestamp = QUIC_TIMESTAMP;
 
 
 	/*
@@ -2753,6 +5813,14 @@ int __quic4_lib_rcv(struct sk_buff *skb, struct udp_table *udptable,
 		if (unlikely(sk->sk_rx_dst != dst))
 			udp_sk_rx_dst_set(sk, dst);
 
+		if (quic_aead_decrypt(sk, skb)) {
+			sock_put(sk);
+			goto drop;
+		}
+		if (quic_syn_rcv_lockless(sk, skb)) {
+			sock_put(sk);
+			return 0;
+		}
 		ret = quic_queue_rcv_skb(sk, skb);
 		sock_put(sk);
 		/* a return value > 0 means to resubmit the input, but
@@ -2767,11 +5835,29 @@ int __quic4_lib_rcv(struct sk_buff *skb, struct udp_table *udptable,
 					saddr, daddr, udptable);
 //in case of error, call error routine and lookup in the UDP table to find the socket
 		sk = __udp4_lib_lookup_skb(skb, qh->source, qh->dest, udptable);
+		//no connection at this address: the peer may have moved, look for the connection ID
+		if ((!sk || sk->sk_state == TCP_CLOSE) && ntohl(qh->type) != SYN) {
+			struct sock *csk = quic_cid_lookup(net, qh);
+
+			if (csk) {
+				if (sk)
+					sock_put(sk);
+				sk = csk;
+			}
+		}
 	}
 
 	if (sk != NULL) {
 		int ret;
 
+		if (quic_aead_decrypt(sk, skb)) {
+			sock_put(sk);
+			goto drop;
+		}
+		if (quic_syn_rcv_lockless(sk, skb)) {
+			sock_put(sk);
+			return 0;
+		}
 		ret = quic_queue_rcv_skb(sk, skb);
 		sock_put(sk);
 
@@ -2883,7 +5969,7 @@ int quic_sendmsg(struct kiocb *iocb, struct sock *sk, struct msghdr *msg,
 	int err;
 	int corkreq = qp->corkflag || msg->msg_flags&MSG_MORE;
 	int (*getfrag)(void *, char *, int, int, int, struct sk_buff *);
-	struct sk_buff *skb;
+	struct sk_buff *skb, *tail;
 	struct ip_options_data opt_copy;
 	struct quic_skb_cb *qb;
 	long timeo;
@@ -2892,6 +5978,14 @@ int quic_sendmsg(struct kiocb *iocb, struct sock *sk, struct msghdr *msg,
 
 	flags = msg->msg_flags;
 
+	//handshake packet of the daemon, in any state
+	if(qp->hs_user && msg->msg_controllen){
+		struct quic_handshake_msg hm;
+
+		if(quic_hs_cmsg(msg, &hm))
+			return quic_hs_sendmsg(sk, msg, len, &hm);
+	}
+
 	timeo = sock_sndtimeo(sk, flags & MSG_DONTWAIT);
 
 //1. check whether the socket is in connected state or not
@@ -2904,7 +5998,7 @@ int quic_sendmsg(struct kiocb *iocb, struct sock *sk, struct msghdr *msg,
 		printk("Error: No connection established before sending data\n");
 		release_sock(sk); //function returns with an error!
 		return -1;
-	}else if(sk->sk_state == TCP_SYN_SENT){ //connection has been initiated but the socket is still in the process of completing the connection handshake -> wait
+	}else if(sk->sk_state == TCP_SYN_SENT && !qp->zero_rtt){ //connection has been initiated but the socket is still in the process of completing the connection handshake -> wait
 		printk("Waiting for connection request to finish\n");
 		if ((err = quic_wait_connect(sk, &timeo)) != 0){
 			printk("Error waiting\n");
@@ -2917,6 +6011,10 @@ int quic_sendmsg(struct kiocb *iocb, struct sock *sk, struct msghdr *msg,
 //length field is checked
 	if (len > 0xFFFF)
 		return -EMSGSIZE;
+	//and against the largest packet of the peer
+	if (len + sizeof(struct quichdr) +
+	    (rcu_access_pointer(qp->aead_tx) ? QUIC_AEAD_OVERHEAD : 0) > qp->peer_tp.max_pkt)
+		return -EMSGSIZE;
 
 	/*
 	 *	Check the flags passed on to the function
@@ -2982,6 +6080,10 @@ int quic_sendmsg(struct kiocb *iocb, struct sock *sk, struct msghdr *msg,
 //if there is a connection, check for destination (pointer to a routing entry is stored)
 	if (connected)
 		rt = (struct rtable *)sk_dst_check(sk, 0);
+//route is gone (interface or address change): move the connection to the current route
+	if (rt == NULL && connected && sk->sk_state == TCP_ESTABLISHED && !qp->server &&
+	    !quic_migrate(sk))
+		rt = (struct rtable *)sk_dst_check(sk, 0);
 //route calculation, if it hasn't already happened
 	if (rt == NULL) {
 		struct net *net = sock_net(sk);
@@ -3034,12 +6136,19 @@ back_from_confirm:
 
 			//qb->offset = qb->sequence = qp->send_next++;
 			qb->offset = qp->send_next++;//set the offset value
-			qb->type = htonl(DATA);	    //It's a data frame (network notation)
-			qb->missing_reports = 0;    //being sent for the first time
+			//It's a data frame (network notation), 0-RTT data until the SYN reply
+			quic_hdr(skb)->type = htonl(sk->sk_state == TCP_SYN_SENT && qp->zero_rtt ? DATA_0RTT : DATA);
+			qb->flags = 0;    //being sent for the first time
+			//the receiver does not wait for a repair packet lost right before it
+			tail = skb_peek_tail(&sk->sk_write_queue);
+			if(tail && ntohl(quic_hdr(tail)->type) == FEC)
+				qb->flags |= QUIC_PKT_AFTER_FEC;
 
 
 			//printk("Queuing packet to send buffer\n");
 			skb_queue_tail(&sk->sk_write_queue, skb);   //added at the end of the queue
+			if(qp->fec && ntohl(quic_hdr(skb)->type) == DATA)
+				quic_fec_add(sk, skb);
 			//printk("Total packets in send queue = %u\n", skb_queue_len(&sk->sk_write_queue));
 			try_send_packets(sk);   //try to send the packets from the send queue (asynchronous packet sending)
 		}
@@ -3136,8 +6245,8 @@ do_confirm:
 //
 //	//qb->offset = qb->sequence = qp->send_next++;
 //	qb->offset = qp->send_next++;
-//	qb->type = htonl(DATA);	//It's a data frame
-//	qb->missing_reports = 0;
+//	quic_hdr(skb)->type = htonl(DATA);	//It's a data frame
+//	qb->flags = 0;
 //
 //	err = try_send_packets(sk);
 //	//err = quic_finish_send_skb(skb, 1, 0);
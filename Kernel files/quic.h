@@ -8,33 +8,185 @@
 #include <linux/skbuff.h>
 #include <linux/mm.h>
 #include <linux/math64.h>
+#include <linux/hrtimer.h>
+#include <linux/interrupt.h>
 //#include <net/ip6_checksum.h>
 #define DATA	10
+#define DATA_0RTT	11	//Data sent with the SYN, before the SYN reply
+#define RETRY	12	//Stateless reply to a SYN: send the SYN again with the cookie
 #define SYN 	13	
 #define SYN_REP	14	
 #define ACK	15
 #define NACK	16
 #define DELTA	17
+#define ECN_ECT0	18	//ECN counts, after the NACK frames of an ACK
+#define ECN_ECT1	19
+#define ECN_CE	20
+#define TOKEN	21	//Address token: issued in the SYN reply, presented in the next SYN to the server
+#define ZRTT_REJECT	22	//SYN reply: the token of the SYN was not accepted, nor its 0-RTT data
+#define COOKIE	23	//Cookie of a RETRY, echoed in the SYN
+#define PATH_CHALLENGE	24	//Path validation packets, 8 bytes of data after the type
+#define PATH_RESPONSE	25
+#define FEC	26	//Repair packet of a group of data packets, struct fec_hdr and their XOR after the type
+#define FEC_RECOVERED	27	//Data packets rebuilt from repair packets so far, after the ECN counts of an ACK
+#define TRANSPORT_PARAMS	28	//Transport parameters of the sender (struct tp_frame), in the SYN and the SYN reply
 #define END	99
 
 
 //QUIC buffer size limit
 #define QUIC_MAX_SENDBUF 64 
 
-//As per RFC6298 at https://tools.ietf.org/html/rfc6298
-#define QUIC_RTO_MAX		((unsigned) (120*HZ))
-#define QUIC_DEL_ACK		msecs_to_jiffies(40)  //As per https://access.redhat.com/documentation/en-US/Red_Hat_Enterprise_MRG/1.3/html/Realtime_Tuning_Guide/sect-Realtime_Tuning_Guide-General_System_Tuning-Reducing_the_TCP_delayed_ack_timeout.html
+//ACK packets: room after the QUIC header, and the NACK frames it takes next to the ACK, DELTA,
+//ECN, FEC_RECOVERED and END frames
+#define QUIC_ACK_SPACE		1024
+#define QUIC_ACK_MAX_NACKS	((QUIC_ACK_SPACE - 2 * sizeof(__be32) - 5 * sizeof(struct ack_frame)) / \
+				 sizeof(struct ack_frame))
+
+//As per RFC6298 at https://tools.ietf.org/html/rfc6298 (all RTT related values in us)
+#define QUIC_RTO_MAX		((unsigned) (120*USEC_PER_SEC))
+#define QUIC_DEL_ACK		((unsigned) (40*USEC_PER_MSEC))  //As per https://access.redhat.com/documentation/en-US/Red_Hat_Enterprise_MRG/1.3/html/Realtime_Tuning_Guide/sect-Realtime_Tuning_Guide-General_System_Tuning-Reducing_the_TCP_delayed_ack_timeout.html
 
 //As per QUIC Doc at https://tools.ietf.org/html/draft-tsvwg-quic-loss-recovery-01 (section 3.2)
-#define QUIC_RTO_MIN		((unsigned) (HZ/5))
-#define RESEND_THRESHOLD 3
+#define QUIC_RTO_MIN		((unsigned) (USEC_PER_SEC/5))
+
+//Loss detection as per RFC 9002 (section 6 and 7.6)
+#define RESEND_THRESHOLD 	3		//Initial packet threshold (default of net.quic.reordering)
+#define QUIC_MAX_REORDERING	300		//Default of net.quic.max_reordering
+#define QUIC_REO_WND_MAX	100		//Default of net.quic.reordering_window, % of SRTT
+#define QUIC_REO_PERSIST	16		//Recovery periods without reordering before the estimate is reset
+
+//Loss differentiation: most queueing delay (as a shift of min RTT) and ACK spreading (x/4 of the
+//send spacing) a loss can come with and still be taken as a random loss of the wireless channel
+#define QUIC_RANDOM_LOSS_QDELAY_SHIFT	2
+#define QUIC_RANDOM_LOSS_SPREAD		5
+#define QUIC_RANDOM_LOSS_CUT_SHIFT	3	//a random loss still takes 1/8 off cwnd, about half of CUBIC's cut
+#define QUIC_RANDOM_LOSS_ROUNDS		8	//SRTTs after a random loss during which losses are congestion
+#define QUIC_GRANULARITY	((unsigned) USEC_PER_MSEC)	//Timer granularity (us)
+#define QUIC_PTO_MAX_BACKOFF	10
+#define QUIC_PERSISTENT_CONGESTION_THRESHOLD	3
+#define QUIC_MIN_CWND		(2 * QUIC_MSS)	//bytes
+
+//ecn_flags
+#define QUIC_ECN_OK		0x1	//Our packets carry ECT(0)
+#define QUIC_ECN_SEEN		0x2	//Peer's packets carry ECN codepoints, ACKs report the counts
+
+//Stateless handshake cookies: age in minutes a cookie is valid for, and the SYN rate (per
+//second and CPU) from which a server with net.quic.syn_cookies = 1 asks for them
+#define QUIC_COOKIE_MAX_AGE	2
+#define QUIC_SYN_FLOOD_RATE	128
+
+//0-RTT tokens: time unit (s) of their counter and age in units they are valid for, and size
+//(bits, as a shift) of the filters of connection IDs whose 0-RTT data was taken
+#define QUIC_TOKEN_UNIT		600
+#define QUIC_TOKEN_MAX_AGE	12
+#define QUIC_ZRTT_BLOOM_BITS	17
+
+//Connection ID table, to find connections whose peer changed address
+#define QUIC_CID_HASH_BITS	8
+
+//Per-destination metrics: what the last connections learned about a path, per network
+//namespace (power of 2). Older entries no longer seed new connections, but keep the 0-RTT token
+#define QUIC_METRICS_CACHE_SIZE	64
+#define QUIC_METRICS_TIMEOUT	(60 * 60 * HZ)
+#define QUIC_METRICS_RATE_TIMEOUT	(10 * 60 * HZ)	//the delivery rate ages faster, it only seeds cwnd
 
 //AS per RFC 5681 on congestion control
-#define IW 		2
+#define IW 		2	//Default of net.quic.initial_window (packets)
+#define QUIC_MAX_IW	64
+
+//The congestion window and the flight are counted in bytes (RFC 9002 section 7); window growth
+//and the minimum window are in units of QUIC_MSS, the datagram size of a full packet
+#define QUIC_MSS		1200
 
 
 #define QUIC_SKB_CB(__skb)       ((struct quic_skb_cb *)&((__skb)->cb[0]))
-#define QUIC_TIMESTAMP   	 ((__u32)(jiffies))
+#define QUIC_TIMESTAMP   	 ((__u32)quic_clock_us())	//Packet timestamps in us, wrap after ~71 minutes
+
+//Monotonic clock in us, used for packet timestamps and the deadlines of the connection timer
+static inline u64 quic_clock_us(void)
+{
+	return ktime_to_us(ktime_get());
+}
+
+//Socket options at level SOL_QUIC
+#define SOL_QUIC		IPPROTO_QUIC
+#define QUIC_CONGESTION		1	/* Congestion control algorithm (name) */
+#define QUIC_MIGRATE		2	/* Move the connection to the current route and source address */
+#define QUIC_ADD_PATH		3	/* Send over another path too, from the local address given (sockaddr_in) */
+#define QUIC_SCHEDULER		4	/* Path of each packet (int, QUIC_SCHED_*) */
+#define QUIC_FEC		5	/* Send repair packets (int, 0 or 1) */
+#define QUIC_CRYPTO		6	/* Packet protection keys (struct quic_crypto_info), write only */
+#define QUIC_HANDSHAKE_USER	7	/* Handshake packets go to a user-space daemon (int, 0 or 1), before connect() */
+#define QUIC_ESTABLISH		8	/* Handshake done in user space (struct quic_handshake_info), write only */
+#define QUIC_TRANSPORT_PARAMS	9	/* Set ours before connect(), get the peer's (struct quic_transport_params) */
+
+//Transport parameters announced in the handshake
+#define QUIC_TP_ECN		0x1	/* features: ECN counts are reported */
+#define QUIC_TP_FEC		0x2	/* repair packets are understood */
+#define QUIC_TP_MPATH		0x4	/* additional paths are accepted */
+#define QUIC_TP_FEATURES	(QUIC_TP_ECN | QUIC_TP_FEC | QUIC_TP_MPATH)
+#define QUIC_MAX_ACK_DELAY	((unsigned) (1*USEC_PER_SEC))	/* largest max_ack_delay taken */
+#define QUIC_MAX_PKT		0xFFFF
+
+struct quic_transport_params {
+	__u32	max_ack_delay;		/* us an ACK may be delayed */
+	__u32	rcv_wnd;		/* bytes that may be in flight towards us, 0 for no limit */
+	__u16	max_pkt;		/* largest packet taken, QUIC header and AEAD tag included */
+	__u16	features;		/* QUIC_TP_* */
+};
+
+//Handshake in user space: SYN, SYN_REP and RETRY pass recvmsg()/sendmsg() with this control message
+#define QUIC_HANDSHAKE		1	/* cmsg type at level SOL_QUIC (struct quic_handshake_msg) */
+#define QUIC_HS_MAX_LEN		1200	/* payload of a handshake packet from user space */
+
+struct quic_handshake_msg {
+	__u32	type;			/* SYN, SYN_REP or RETRY */
+	__be64	conn_id;
+};
+
+struct quic_handshake_info {
+	struct sockaddr_in	peer;
+	__be64			conn_id;
+	__u32			server;		/* 1 on the side that answered the SYN */
+	struct quic_transport_params	params;	/* of the peer */
+};
+
+//AEAD packet protection
+#define QUIC_CIPHER_AES_GCM_128		1
+#define QUIC_CIPHER_AES_GCM_256		2
+#define QUIC_CIPHER_CHACHA20_POLY1305	3
+
+#define QUIC_AEAD_KEY_MAX	32
+#define QUIC_AEAD_IV_LEN	12
+#define QUIC_AEAD_TAG_LEN	16
+#define QUIC_AEAD_OVERHEAD	(QUIC_AEAD_TAG_LEN + sizeof(__be64))	/* tag and packet counter after the payload */
+#define QUIC_AEAD_MAX_SG	8	/* scatterlist entries of a packet, more frags are linearized */
+#define QUIC_AEAD_REQ_SIZE	1024	/* aead_request with the context of the algorithm */
+#define QUIC_REPLAY_BITS	2048	/* bitmap of the replay window, a power of 2 */
+#define QUIC_REPLAY_WORDS	(QUIC_REPLAY_BITS / 64)
+#define QUIC_REPLAY_WINDOW	(QUIC_REPLAY_BITS - 64)	/* packet counters behind the highest one still accepted */
+
+struct quic_crypto_info {
+	__u16	cipher;			/* QUIC_CIPHER_* */
+	__u8	tx_key[QUIC_AEAD_KEY_MAX];
+	__u8	tx_iv[QUIC_AEAD_IV_LEN];
+	__u8	rx_key[QUIC_AEAD_KEY_MAX];
+	__u8	rx_iv[QUIC_AEAD_IV_LEN];
+};
+
+//Key of one direction
+struct quic_aead {
+	struct crypto_aead	*tfm;
+	u8			iv[QUIC_AEAD_IV_LEN];
+};
+
+//Multipath packet schedulers
+#define QUIC_SCHED_MINRTT	0	/* lowest RTT path with room in its congestion window */
+#define QUIC_SCHED_RATE		1	/* paths share the packets in proportion to cwnd / RTT */
+
+//Pluggable congestion control
+#define QUIC_CA_NAME_MAX	16
+#define QUIC_CA_PRIV_SIZE	(24 * sizeof(u64))	/* per socket state of the algorithm */
 
 //TCP Cubic
 
@@ -43,34 +195,40 @@
 					 */
 #define	BICTCP_HZ		10	/* BIC HZ 2^10 = 1024 */
 
-/* Two methods of hybrid slow start */
-#define HYSTART_ACK_TRAIN	0x1
-#define HYSTART_DELAY		0x2
-
-/* Number of delay samples for detecting the increase of delay */
-#define HYSTART_MIN_SAMPLES	8
-#define HYSTART_DELAY_MIN	(4U<<3)
-#define HYSTART_DELAY_MAX	(16U<<3)
-#define HYSTART_DELAY_THRESH(x)	clamp(x, HYSTART_DELAY_MIN, HYSTART_DELAY_MAX)
+/* HyStart++ as per RFC 9406 (section 4.3) */
+#define HYSTART_MIN_RTT_THRESH	(4000U)		/* 4 ms */
+#define HYSTART_MAX_RTT_THRESH	(16000U)	/* 16 ms */
+#define HYSTART_MIN_RTT_DIVISOR	8
+#define HYSTART_N_RTT_SAMPLE	8	/* RTT samples per round before deciding */
+#define HYSTART_CSS_GROWTH_DIVISOR	4	/* cwnd grows 4 times slower in CSS */
+#define HYSTART_CSS_ROUNDS	5	/* rounds in CSS before congestion avoidance */
+#define HYSTART_L		8	/* cwnd increase limit per ACK (packets), no pacing */
+#define HYSTART_RTT_THRESH(x)	clamp(x, HYSTART_MIN_RTT_THRESH, HYSTART_MAX_RTT_THRESH)
 
 
 extern struct proto 		quic_prot;
 extern struct udp_table		quic_table;
 
 enum timer_flags {
-        QUIC_RTO_TLP_TIMER_DEFERRED,  /* quic_rto_tlp_timer() found socket was owned */
-        QUIC_DEL_ACK_TIMER_DEFERRED,  /* quic_rto_tlp_timer() found socket was owned */
-        QUIC_EARLY_RETRANS_TIMER_DEFERRED,  /* quic_rto_tlp_timer() found socket was owned */
-        QUIC_HSHAKE_LOSS_TIMER_DEFERRED  /* tcp_write_timer() found socket was owned */
+        QUIC_TIMER_DEFERRED,  /* quic_timer() found socket was owned */
+        QUIC_ACK_DEFERRED,  /* quic_ack_batch_handler() found socket was owned */
+        QUIC_TIMER_ARMED,  /* the connection timer holds a socket reference */
         //TCP_DELACK_TIMER_DEFERRED, /* tcp_delack_timer() found socket was owned */
         //TCP_MTU_REDUCED_DEFERRED,  /* tcp_v{4|6}_err() could not call
         //                            * tcp_v{4|6}_mtu_reduced()
         //                            */
 };
+#define QUIC_DEFERRED_ALL	((1UL << QUIC_TIMER_DEFERRED) | (1UL << QUIC_ACK_DEFERRED))
+
+enum ack_flags {
+        QUIC_ACK_QUEUED  /* socket is on the per-CPU ACK batch list */
+};
 
 enum state {
         QUIC_CA_Open,  
-	QUIC_Loss  
+	QUIC_CA_Disorder,
+	QUIC_CA_Recovery,
+	QUIC_CA_Loss  
 };
 
 
@@ -83,9 +241,10 @@ struct quichdr {
 		pres:1,
 		div:1,
 		cid:1,
-		pnum:2,
+		pnum:1,
+		rep:1,		//the packet before this one is a repair packet
 		mpath:1,
-		uused:1;
+		prot:1;		//payload protected with AEAD
 	__be64	conn_id;
 	__be32	version;
 	__be32	offset;
@@ -93,16 +252,18 @@ struct quichdr {
 	__be32 	type;		//To put this in switch case, Need to have an END tag
 };
 
+/*  Control block of a QUIC packet, it has to fit into the 48 bytes of skb->cb. QUIC is IPv4
+    only, so there is no room kept for inet6_skb_parm. The frame type lives in the QUIC header
+    only. The UDP checksum coverage is only needed for received packets and shares its space
+    with the state of sent packets */
 struct quic_skb_cb {
 	//Specific to UDP
         union {
              struct inet_skb_parm    h4;
-#if IS_ENABLED(CONFIG_IPV6)
-             struct inet6_skb_parm   h6;
-#endif
         } header;
-        __u16   cscov;
-        __u8    partial_cov;
+	__u16	cscov;
+	__u8	partial_cov;
+	__u8	flags;			//QUIC_PKT_* state of a sent packet (padding of the UDP fields)
 
 	//Specific to QUIC
 	__u8	ver:1,
@@ -112,12 +273,27 @@ struct quic_skb_cb {
 		pnum:2,
 		mpath:1,
 		uused:1;
+	__u8	path;			//Path the packet was sent on, 0 is the connection's own
+	__u16	send_elapsed;		//Send time - first send time of its flight (units of QUIC_RATE_ELAPSED_US)
 	__be32	offset;
 	__be32	sequence;
-	__be32 	type;		//Last field, First frame type in the datagram
-	__u32	timestamp;		//Calculate RTT
-	__u32	missing_reports;		//NACK count
-};
+	__u32	timestamp;		//Calculate RTT (us)
+
+	//Delivery rate sampling: connection state when the packet was (re)sent
+	__u32	delivered;		//Packets delivered so far
+	__u32	delivered_time;		//Time (us) the last of them was ACKed
+};	//48 bytes, all of skb->cb
+
+//granularity of send_elapsed, which saturates at about 2 s
+#define QUIC_RATE_ELAPSED_US	32
+
+//Sent packet state (quic_skb_cb flags)
+#define QUIC_PKT_LOST		0x1	//Declared lost, waiting for retransmission
+#define QUIC_PKT_RETRANS	0x2	//Has been retransmitted at least once
+#define QUIC_PKT_APP_LIMITED	0x4	//Sent while the application did not fill cwnd
+#define QUIC_PKT_NACKED		0x8	//Reported missing by an ACK
+#define QUIC_PKT_ECT		0x10	//Sent with ECT(0)
+#define QUIC_PKT_AFTER_FEC	0x20	//Queued right behind a repair packet
 
 /*************** Frame type ***********************
  Data	10
@@ -137,35 +313,163 @@ struct syn_cookie {
 	__be32 cookie;
 };
 
+struct token_frame {
+	__be32 id;		// TOKEN or COOKIE
+	__be32 token;
+};
+
+//Repair packet: the payloads of the data packets offset .. offset + count - 1 XORed, zero padded
+struct fec_hdr {
+	__be32 offset;		// first packet of the group
+	__be16 count;
+	__be16 len;		// payload lengths XORed
+	__be32 seq;		// sequence numbers of the members in seq_mask XORed
+	__be16 seq_mask;	// members still unacknowledged when it was first sent
+	__be16 unused;
+};
+
 struct ack_frame {
 	__be32 id;		// Right now, setting it to 14 (Just a random choice)
 	__be32 offset;
 //	__be32 sequence;
 };
 
+//Transport parameters of the sender (struct quic_transport_params on the wire)
+struct tp_frame {
+	__be32 id;		// TRANSPORT_PARAMS
+	__be32 max_ack_delay;
+	__be32 rcv_wnd;
+	__be16 max_pkt;
+	__be16 features;
+};
+
+//Outcome of one pass over the send queue for an incoming ACK
+struct quic_ack_sample {
+	u32	acked;		/* packets newly ACKed by this ACK */
+	u32	ect_acked;	/* of them, packets sent with ECT(0) */
+	u32	acked_bytes;	/* and their bytes */
+	u32	mp_acked;	/* packets newly ACKed which were sent on the other paths */
+	u8	rtt_path;	/* path of the sent_time packet */
+	u32	nacked;		/* packets reported missing by this ACK */
+	u32	sent_time;	/* send time of the packet the ACK was generated for */
+	bool	rtt_valid;	/* sent_time can be used as an RTT sample */
+	u32	lost;		/* packets declared lost */
+	u32	lost_bytes;
+	u32	lost_sent_time;	/* send time of the newest lost packet */
+	u32	loss_time;	/* earliest time threshold of a packet not yet lost */
+	bool	loss_time_valid;
+	u32	run_start;	/* send time span of the current run of lost packets */
+	u32	run_end;
+	u32	run_len;
+	bool	persistent;	/* persistent congestion */
+	bool	recovered;	/* a packet sent during recovery was ACKed */
+	bool	ce;		/* the peer reported new CE marks */
+	u32	spurious;	/* ACKed packets whose loss turned out to be spurious */
+	bool	reordered;	/* a packet reported missing or lost was ACKed after all */
+	u32	reorder;	/* largest reordering distance of those, in packets */
+	u32	reorder_time;	/* largest delay of those beyond SRTT (us) */
+	bool	undo_fail;	/* an ACKed packet did need its retransmission */
+
+	/* delivery rate sample, from the most recently sent of the ACKed packets */
+	u32	prior_delivered;	/* delivered count when that packet was sent */
+	u32	prior_time;		/* delivered_time when that packet was sent */
+	u32	send_elapsed;		/* its send time - first_sent_time of its flight */
+	u32	ack_elapsed;		/* now - delivered_time when it was sent */
+	bool	prior_valid;
+	bool	is_app_limited;		/* sample taken while application limited */
+	u32	delivered;		/* packets delivered over the interval */
+	s32	interval_us;		/* sampling interval, -1 if invalid */
+};
+
+struct quic_congestion_ops {
+	struct list_head	list;
+
+	/* initialize private data, called with the first ACK (required) */
+	void (*init)(struct sock *sk);
+	/* cleanup private data (optional) */
+	void (*release)(struct sock *sk);
+	/* new ACK, with the outcome of the pass over the send queue (required) */
+	void (*on_ack)(struct sock *sk, const struct quic_ack_sample *rs,
+		       u32 prior_in_flight, s32 rtt);
+	/* start of a recovery period, cwnd and ssthresh have to be reduced (required) */
+	void (*on_loss)(struct sock *sk, const struct quic_ack_sample *rs);
+	/* persistent congestion, cwnd is already collapsed (optional) */
+	void (*on_rto)(struct sock *sk);
+	/* new value of cwnd after a spurious loss (optional) */
+	u32 (*undo)(struct sock *sk);
+	/* pacing rate in bytes per second, 0 for no pacing (optional) */
+	u64 (*pacing_rate)(struct sock *sk);
+
+	char 		name[QUIC_CA_NAME_MAX];
+	struct module 	*owner;
+};
+
 struct quic_bictcp {
 	u32	cnt;		/* increase cwnd by 1 after ACKs */
-	u32 	last_max_cwnd;	/* last maximum snd_cwnd */
-	u32	loss_cwnd;	/* congestion window at last loss */
-	u32	last_cwnd;	/* the last snd_cwnd */
+	u32 	last_max_cwnd;	/* last maximum snd_cwnd (packets) */
+	u32	loss_cwnd;	/* congestion window at last loss (bytes) */
+	u32	last_cwnd;	/* the last snd_cwnd (packets) */
 	u32	last_time;	/* time when updated last_cwnd */
 	u32	bic_origin_point;/* origin point of bic function */
 	u32	bic_K;		/* time to origin point from the beginning of the current epoch */
-	u32	delay_min;	/* min delay (msec << 3) */
+	u32	delay_min;	/* min delay (usec) */
 	u32	epoch_start;	/* beginning of an epoch */
-	u32	ack_cnt;	/* number of acks */
-	u32	tcp_cwnd;	/* estimated tcp cwnd */
-#define ACK_RATIO_SHIFT	4
-#define ACK_RATIO_LIMIT (32u << ACK_RATIO_SHIFT)
-	u16	delayed_ack;	/* estimate the ratio of Packets/ACKs << 4 */
-	u8	sample_cnt;	/* number of samples to decide curr_rtt */
-	u8	found;		/* the exit point is found? */
-	u32	round_start;	/* beginning of each round */
-	u32	end_seq;	/* end_seq of the round */
-	u32	last_ack;	/* last time when the ACK spacing is close */
-	u32	curr_rtt;	/* the minimum rtt of current round */
+	u32	ack_cnt;	/* bytes acked */
+	u32	tcp_cwnd;	/* estimated tcp cwnd (packets) */
+	u8	sample_cnt;	/* number of RTT samples in the current round */
+	u8	css_rounds;	/* rounds spent in conservative slow start */
+	u8	css_acked;	/* bytes acked in CSS not yet worth a byte of cwnd */
+	u32	end_seq;	/* sequence number ending the current round */
+	u32	curr_rtt;	/* the minimum rtt of current round (usec) */
+	u32	last_rtt;	/* the minimum rtt of the previous round (usec) */
+	u32	css_baseline;	/* min rtt when CSS was entered (usec), 0 outside CSS */
+};
+
+/* LEDBAT keeps the base delay (delay_min) and the minimum RTT of the current round (curr_rtt,
+ * ending at end_seq) in the same fields as CUBIC */
+struct quic_ledbat {
+	struct quic_bictcp bic;
+	s64	cwnd_acc;	/* window change not applied yet, in packets * us of off target */
+	u32	base_next;	/* min delay of the current base delay window (usec) */
+	u32	base_stamp;	/* start of that window (usec) */
+};
+
+
+/*  Forward error correction: one repair packet per group of QUIC_FEC_MIN_GROUP to
+    QUIC_FEC_MAX_GROUP data packets, the group size follows the loss rate */
+#define QUIC_FEC_MIN_GROUP	2
+#define QUIC_FEC_MAX_GROUP	16
+#define QUIC_FEC_MAX_PAYLOAD	1400	//Larger packets are not protected
+#define QUIC_FEC_RING		(2 * QUIC_FEC_MAX_GROUP)	//Data packets kept by the receiver
+#define QUIC_FEC_LOSS_SHIFT	10	//Fixed point of the loss rate
+
+//Receiver: copy of the payload of a recent data packet, for the repair packet of its group
+struct quic_fec_slot {
+	__be32	offset;
+	__be32	sequence;
+	u16	len;
+	u8	data[QUIC_FEC_MAX_PAYLOAD];
 };
 
+/*  Multipath: a path besides the connection's own one, with its own route, congestion window
+    (NewReno in bytes) and RTT. Path 0 is the connection's own, whose state is in quic_sock */
+#define QUIC_MAX_PATHS		4	//Including path 0
+#define QUIC_MPATH_LOSS_ROUNDS	3	//Window reductions in a row without an ACK before a path is given up
+
+struct quic_path {
+	struct rtable	*rt;		//Route, NULL if the path is not in use
+	__be32		saddr;
+	__be32		daddr;
+	__be16		dport;
+	u32		cwnd;		//bytes
+	u32		ssthresh;
+	u32		cwnd_cnt;	//bytes ACKed in congestion avoidance since the last increase
+	u32		bytes_in_flight;
+	u32		srtt;		//us << 3
+	u32		acked_seq;	//Sequence of the largest ACKed packet sent on the path
+	u32		recovery_start;	//Send time (us) of the last window reduction
+	u8		loss_rounds;	//Window reductions since the last ACK
+};
 
 struct quic_sock {
 	/* inet_sock has to be the first member */
@@ -201,12 +505,21 @@ struct quic_sock {
 
 	__be64		conn_id;
 	__be64 		syn_cookie;
+	struct hlist_node	cid_node;	//In the connection ID table while established
+
+	//Connection migration: new peer address being validated (0 if none)
+	__be32			path_daddr;
+	__be16			path_dport;
+	__be64			path_challenge;
+	u32			path_challenge_time;	//us
+	bool			path_mpath;	//Validated address becomes an additional path, not the new one
 
 
 	// Send/Receive Queue variables
 	// *********************************
 	
 	bool	 	syn_acked;		//Check if the SYN reply has been acked
+	bool		zero_rtt;		//Client: data may go out before the SYN reply. Server: the SYN's token was valid, its 0-RTT data is accepted
 	__be32		syn_offset;
 
 	__be32		first_unack;		//Head of send window
@@ -217,16 +530,32 @@ struct quic_sock {
 
 	__be32		highest_rcv;		//Highest received packet offset at receiver
 	__be32		highest_rcv_sequence;	//Highest received packet sequence at receiver
-	__u32		highest_rcv_time;
+	__u32		highest_rcv_time;	//Arrival time (us) of the highest received packet
 
 	__be32		highest_ack;		//Highest acked packet at sender
 	__be32		highest_ack_sequence;	//Highest acked packet at sender
-	__u32		highest_ack_rtt;
+	__u32		highest_ack_rtt;	//Last RTT sample (us)
 
 	unsigned int		packets_out;	//Keep account
+	unsigned int		bytes_in_flight;	//Bytes of the packets_out packets, limited by cwnd
 	unsigned int		nacked_in_q;
+	unsigned int		lost_out;	//Declared lost and not yet retransmitted
+
+	//Delivery rate sampling
+	u32			delivered;	//Packets ACKed so far
+	u32			delivered_time;	//Time (us) of the last ACK delivering packets
+	u32			first_sent_time;	//Send time (us) of the first packet of the flight
+	u32			app_limited;	//delivered + in flight when application limited, 0 if not
+	u32			avg_pkt_len;	//Smoothed length of the packets sent (bytes)
+	u32			rate_max;	//Largest delivery rate sampled (bytes per second), for the metrics cache
 	struct sk_buff		*last_sent;	//Keep track of the last sent packet
 
+	//Multipath: the other paths (path 1 is mpath[0]), packet numbers are shared by all paths
+	struct quic_path	mpath[QUIC_MAX_PATHS - 1];
+	u8			mpath_cnt;	//Paths in use besides path 0
+	u8			mpath_sched;	//QUIC_SCHED_*
+	u32			mp_acked_seq;	//Sequence of the largest ACKed packet sent on path 0
+
 	//struct sk_buff_head     send_buffer;
 	//struct sk_buff_head     rcv_buffer;
 
@@ -234,31 +563,83 @@ struct quic_sock {
 	// ***********************************
 	unsigned long   	timer_flags;
 
-	struct timer_list	quic_hshake_loss_timer;
-	__u32			hshake_loss_timeout;
-
-	struct timer_list	quic_rto_tlp_timer;
-	unsigned int		tlp_out;
-
-	struct timer_list	quic_del_ack_timer;
-
-	struct timer_list	quic_early_retrans_timer;
-
-	unsigned int		retransmits;	//For Backoff
-
-	unsigned long		tlp_rto_time;
-	unsigned long		hshake_loss_time;
-	unsigned long		del_ack_time;
-	unsigned long		early_retransmit_time;
-
-	u32     		srtt;           /* smoothed round trip time << 3        */
+	//One hrtimer per connection, armed for the earliest of the deadlines below (in us, 0 = not pending)
+	struct tasklet_hrtimer	quic_timer;
+	u64			timer_expires;	//Deadline the hrtimer is armed for, 0 if idle
+
+	//Loss detection (RFC 9002): time threshold or probe timeout
+	u64			loss_detection_time;
+	u64			loss_time;	//Earliest time threshold of a packet in flight, 0 if none
+	unsigned int		pto_count;	//Consecutive PTOs, for backoff
+	__u32			last_sent_time;	//Timestamp of the last packet sent (us)
+	__u32			recovery_start;	//Start of the current recovery period (us)
+	unsigned int		prr_target;	//Window to reach at the end of recovery, 0 if PRR is not running
+	unsigned int		prr_delivered;	//Bytes delivered since recovery started
+	unsigned int		prr_out;	//Bytes sent since recovery started
+	unsigned int		recover_fs;	//Bytes in flight when recovery started
+	//Reordering estimator: packet threshold and extra time threshold from the reordering observed
+	unsigned int		reordering;
+	u32			reo_wnd;	//Added to the RTT in the time threshold (us)
+	unsigned int		reo_persist;	//Recovery periods left before the estimate decays
+
+	//Undo of spurious recovery: losses of this recovery period not yet proven spurious
+	bool			undo_marker;
+	unsigned int		undo_retrans;
+	u32			undo_reorder;	//Largest reordering measured for them, in packets
+	unsigned int		prior_cwnd;
+	unsigned int		prior_ssthresh;
+
+	//ECN (RFC 9000 section 13.4): counts of received codepoints, and the CE count last reported by the peer
+	__u8			ecn_flags;
+	u32			ecn_rcv[3];	//ECT(0), ECT(1), CE
+	u32			ecn_ect_acked;	//ECT(0) + CE reported by the peer
+	u32			ecn_ect_sent;	//Packets sent with ECT(0) and ACKed since
+	u32			ecn_ce_acked;
+
+	//Forward error correction, sender: group being XORed into fec_buf (struct fec_hdr first)
+	bool			fec;
+	u8			fec_group;	//Data packets per repair packet
+	u8			fec_cnt;	//Data packets in the current group
+	u16			fec_len;	//Their payload lengths XORed
+	u16			fec_max_len;	//Longest of them
+	__be32			fec_first;	//Offset of the first of them
+	u8			*fec_buf;
+	u32			fec_loss;	//Loss rate (QUIC_FEC_LOSS_SHIFT), packets rebuilt by the peer included
+	u32			fec_recovered_acked;	//FEC_RECOVERED last reported by the peer
+	//receiver: recent data packets, to rebuild a missing one from a repair packet
+	bool			fec_rcv;	//The peer sends repair packets
+	u32			fec_recovered;
+	struct quic_fec_slot	*fec_ring[QUIC_FEC_RING];
+
+	//AEAD packet protection, NULL until user space installs keys
+	struct quic_aead __rcu	*aead_tx;
+	struct quic_aead __rcu	*aead_rx;
+	atomic64_t		aead_tx_pn;	//Packets protected so far, nonce of the next one
+	spinlock_t		aead_rx_lock;	//Replay window, packets are decrypted without the socket lock
+	u64			aead_rx_next;	//Highest packet counter received + 1
+	u64			aead_rx_seen[QUIC_REPLAY_WORDS];	//Bit n % QUIC_REPLAY_BITS: counter n - 1 received
+	bool			hs_user;	//Handshake packets are left to a user-space daemon
+
+	//transport parameters: ours as sent in the handshake, the peer's as received
+	struct quic_transport_params	local_tp;
+	struct quic_transport_params	peer_tp;
+
+	u64			del_ack_time;
+
+	//ACK aggregation: socket is linked on the per-CPU list until the end of the softirq batch
+	unsigned long		ack_flags;
+	struct list_head	ack_node;
+
+	u32     		srtt;           /* smoothed round trip time (us) << 3   */
 	u32     		mdev;           /* medium deviation                     */
 	u32     		mdev_max;       /* maximal mdev for the last rtt period */
 	u32     		rttvar;         /* smoothed mdev_max                    */
 	u32     		rtt_seq;        /* sequence number to update rttvar     */
 
-	u32			rto;
-	unsigned int		number_rto_packets;
+	u32			rto;		/* us */
+	u32			latest_rtt;	/* us */
+	u32			min_rtt;	/* us */
+	u32			random_loss_time;	/* us, last loss taken as random */
 
 	bool			first_rtt;
 	bool			first_ack;
@@ -267,26 +648,11 @@ struct quic_sock {
 
 	//Congestion control
 	unsigned long	 	ca_state;
-	unsigned int		cwnd;
-	unsigned int		cwnd_cnt;
-	unsigned int		ssthresh;
-	struct quic_bictcp		ca;
-
-	int fast_convergence;
-	int beta;	/* = 717/1024 (BICTCP_BETA_SCALE) */
-	int initial_ssthresh;
-	int bic_scale;
-	int tcp_friendliness;
-	
-	int hystart;
-	int hystart_detect;
-	int hystart_low_window;
-	int hystart_ack_delta;
-	
-	u32 cube_rtt_scale;
-	u32 beta_scale;
-	u64 cube_factor;
-
+	unsigned int		cwnd;		//bytes
+	unsigned int		cwnd_cnt;	//bytes ACKed towards the next increase
+	unsigned int		ssthresh;	//bytes
+	const struct quic_congestion_ops	*ca_ops;
+	u64			ca_priv[QUIC_CA_PRIV_SIZE / sizeof(u64)];
 };
 
 static inline struct quic_sock *quic_sk(const struct sock *sk)
@@ -294,6 +660,11 @@ static inline struct quic_sock *quic_sk(const struct sock *sk)
 	return (struct quic_sock *)sk;
 }
 
+static inline void *quic_ca(const struct sock *sk)
+{
+	return (void *)quic_sk(sk)->ca_priv;
+}
+
 static inline struct quichdr *quic_hdr(const struct sk_buff *skb)
 {
 	return (struct quichdr *)skb_transport_header(skb);
@@ -352,7 +723,16 @@ int quic_sendpage(struct sock *sk, struct page *page, int offset,
 		 size_t size, int flags);
 int quic_finish_send_skb(struct sk_buff *skb, int clone, int retransmit);
 int try_send_packets(struct sock *sk);
-void retransmit_nacked(struct sock *sk, const unsigned int threshold);
+void quic_set_loss_detection_timer(struct sock *sk);
 int send_ack(struct sock *sk);
+struct sk_buff *quic_ip_make_skb(struct sock *sk, struct flowi4 *fl4, int length);
+bool is_in_rcv_q(struct sock *sk, __be32 offset);
+
+int quic_register_congestion_control(struct quic_congestion_ops *ca);
+void quic_unregister_congestion_control(struct quic_congestion_ops *ca);
+int quic_set_congestion_control(struct sock *sk, const char *name);
+int quic_slow_start(struct sock *sk, u32 acked);
+void quic_cong_avoid_ai(struct sock *sk, u32 w, u32 acked);
+bool quic_is_cwnd_limited(const struct sock *sk, u32 in_flight);
 
 #endif	/* _QUIC_H */
@@ -0,0 +1,741 @@
+/* Bottleneck Bandwidth and RTT (BBR) congestion control for QUIC
+ *
+ * Port of the TCP BBR module (net/ipv4/tcp_bbr.c) to the QUIC socket. BBR builds a model of
+ * the path from the delivery rate samples of quic.c and the minimum RTT, and paces at about
+ * the estimated bottleneck bandwidth with a cwnd of about twice the bandwidth-delay product.
+ * Packet loss does not reduce the model, only a lower delivery rate does, so random losses
+ * on wireless links do not cut the sending rate as with CUBIC.
+ *
+ * Differences to the TCP version:
+ * - the model is in packets, bandwidth in packets per us << BW_SCALE, times are in us
+ *   (QUIC_TIMESTAMP) instead of jiffies
+ * - the pacing rate and the cwnd of the socket are in bytes, converted from the model with
+ *   the smoothed length of the packets sent
+ * - no long-term bandwidth (policer) detection: on our lossy wireless paths it would mistake
+ *   random loss for a policer
+ * - no restart from idle, QUIC has no cwnd event for the start of a transmission
+ *
+ * The pacing itself is done by the fq qdisc, which has to be configured on the interface.
+ */
+
+#define pr_fmt(fmt) "QUIC BBR: " fmt
+
+#include <linux/module.h>
+#include <linux/random.h>
+#include <net/tcp.h>
+#include <net/quic.h>
+
+/* Scale factor for rate in pkt/uSec unit to avoid truncation in bandwidth
+ * estimation. The rate unit ~= (1500 bytes / 1 usec / 2^24) ~= 715 bps.
+ */
+#define BW_SCALE 24
+#define BW_UNIT (1 << BW_SCALE)
+
+#define BBR_SCALE 8	/* scaling factor for fractions in BBR (e.g. gains) */
+#define BBR_UNIT (1 << BBR_SCALE)
+
+#define QUIC_BBR_PKT_LEN	1200	/* packet length (bytes) until packets have been sent */
+
+/* BBR has the following modes for deciding how fast to send: */
+enum bbr_mode {
+	BBR_STARTUP,	/* ramp up sending rate rapidly to fill pipe */
+	BBR_DRAIN,	/* drain any queue created during startup */
+	BBR_PROBE_BW,	/* discover, share bw: pace around estimated bw */
+	BBR_PROBE_RTT,	/* cut cwnd to min to probe min_rtt */
+};
+
+/* Windowed max filter, as lib/win_minmax.c: the best, 2nd best and 3rd best samples of a
+ * window, each with the time (here the round trip count) it was taken at.
+ */
+struct quic_minmax_sample {
+	u32	t;	/* time measurement was taken */
+	u32	v;	/* value measured */
+};
+
+struct quic_minmax {
+	struct quic_minmax_sample s[3];
+};
+
+/* BBR congestion control block */
+struct quic_bbr {
+	u32	min_rtt_us;	        /* min RTT in min_rtt_win_sec window */
+	u32	min_rtt_stamp;	        /* timestamp (us) of min_rtt_us */
+	u32	probe_rtt_done_stamp;   /* end time (us) for BBR_PROBE_RTT mode */
+	struct quic_minmax bw;	/* Max recent delivery rate in pkts/uS << 24 */
+	u32	rtt_cnt;	    /* count of packet-timed rounds elapsed */
+	u32     next_rtt_delivered; /* scb->tx.delivered at end of round */
+	u32	cycle_mstamp;	     /* time (us) of this cycle phase */
+	u32     mode:3,		     /* current bbr_mode in state machine */
+		prev_ca_state:3,     /* CA state on previous ACK */
+		packet_conservation:1,  /* use packet conservation? */
+		restore_cwnd:1,	     /* decided to revert cwnd to old value */
+		round_start:1,	     /* start of packet-timed tx->ack round? */
+		probe_rtt_round_done:1,  /* a BBR_PROBE_RTT round at 4 pkts? */
+		unused:22;
+	u32	pacing_gain:10,	/* current gain for setting pacing rate */
+		cwnd_gain:10,	/* current gain for setting cwnd */
+		full_bw_cnt:3,	/* number of rounds without large bw gains */
+		cycle_idx:3,	/* current index in pacing_gain cycle array */
+		unused_b:6;
+	u32	prior_cwnd;	/* prior cwnd upon entering loss recovery */
+	u32	full_bw;	/* recent bw, to estimate if pipe is full */
+	u64	pacing_rate;	/* bytes per second */
+};
+
+#define CYCLE_LEN	8	/* number of phases in a pacing gain cycle */
+
+/* Window length of bw filter (in rounds): */
+static const int bbr_bw_rtts = CYCLE_LEN + 2;
+/* Window length of min_rtt filter (in us): */
+static const u32 bbr_min_rtt_win_us = 10 * USEC_PER_SEC;
+/* Minimum time (in us) spent at bbr_cwnd_min_target in BBR_PROBE_RTT mode: */
+static const u32 bbr_probe_rtt_mode_us = 200 * USEC_PER_MSEC;
+
+/* We use a high_gain value of 2/ln(2) because it's the smallest pacing gain
+ * that will allow a smoothly increasing pacing rate that will double each RTT
+ * and send the same number of packets per RTT that an un-paced, slow-starting
+ * Reno or CUBIC flow would:
+ */
+static const int bbr_high_gain  = BBR_UNIT * 2885 / 1000 + 1;
+/* The pacing gain of 1/high_gain in BBR_DRAIN is calculated to typically drain
+ * the queue created in BBR_STARTUP in a single round:
+ */
+static const int bbr_drain_gain = BBR_UNIT * 1000 / 2885;
+/* The gain for deriving steady-state cwnd tolerates delayed/stretched ACKs: */
+static const int bbr_cwnd_gain  = BBR_UNIT * 2;
+/* The pacing_gain values for the PROBE_BW gain cycle, to discover/share bw: */
+static const int bbr_pacing_gain[] = {
+	BBR_UNIT * 5 / 4,	/* probe for more available bw */
+	BBR_UNIT * 3 / 4,	/* drain queue and/or yield bw to other flows */
+	BBR_UNIT, BBR_UNIT, BBR_UNIT,	/* cruise at 1.0*bw to utilize pipe, */
+	BBR_UNIT, BBR_UNIT, BBR_UNIT	/* without creating excess queue... */
+};
+
+/* Try to keep at least this many packets in flight, if things go smoothly. For
+ * smooth functioning, a sliding window protocol ACKing every other packet
+ * needs at least 4 packets in flight:
+ */
+static const u32 bbr_cwnd_min_target = 4;
+
+/* To estimate if BBR_STARTUP mode (i.e. high_gain) has filled pipe... */
+/* If bw has increased significantly (1.25x), there may be more bw available: */
+static const u32 bbr_full_bw_thresh = BBR_UNIT * 5 / 4;
+/* But after 3 rounds w/o significant bw growth, estimate pipe is full: */
+static const u32 bbr_full_bw_cnt = 3;
+
+/* Windowed max filter */
+
+static inline u32 quic_minmax_get(const struct quic_minmax *m)
+{
+	return m->s[0].v;
+}
+
+static inline u32 quic_minmax_reset(struct quic_minmax *m, u32 t, u32 meas)
+{
+	struct quic_minmax_sample val = { .t = t, .v = meas };
+
+	m->s[2] = m->s[1] = m->s[0] = val;
+	return m->s[0].v;
+}
+
+/* As time advances, update the 1st, 2nd, and 3rd choices. */
+static u32 quic_minmax_subwin_update(struct quic_minmax *m, u32 win,
+				     const struct quic_minmax_sample *val)
+{
+	u32 dt = val->t - m->s[0].t;
+
+	if (unlikely(dt > win)) {
+		/*
+		 * Passed entire window without a new val so make 2nd
+		 * choice the new val & 3rd choice the new 2nd choice.
+		 * we may have to iterate this since our 2nd choice
+		 * may also be outside the window (we checked on entry
+		 * that the third choice was in the window).
+		 */
+		m->s[0] = m->s[1];
+		m->s[1] = m->s[2];
+		m->s[2] = *val;
+		if (unlikely(val->t - m->s[0].t > win)) {
+			m->s[0] = m->s[1];
+			m->s[1] = m->s[2];
+			m->s[2] = *val;
+		}
+	} else if (unlikely(m->s[1].t == m->s[0].t) && dt > win/4) {
+		/*
+		 * We've passed a quarter of the window without a new val
+		 * so take a 2nd choice from the 2nd quarter of the window.
+		 */
+		m->s[2] = m->s[1] = *val;
+	} else if (unlikely(m->s[2].t == m->s[1].t) && dt > win/2) {
+		/*
+		 * We've passed half the window without finding a new val
+		 * so take a 3rd choice from the last half of the window
+		 */
+		m->s[2] = *val;
+	}
+	return m->s[0].v;
+}
+
+/* Check if new measurement updates the 1st, 2nd or 3rd choice max. */
+static u32 quic_minmax_running_max(struct quic_minmax *m, u32 win, u32 t, u32 meas)
+{
+	struct quic_minmax_sample val = { .t = t, .v = meas };
+
+	if (unlikely(val.v >= m->s[0].v) ||	  /* found new max? */
+	    unlikely(val.t - m->s[2].t > win))	  /* nothing left in window? */
+		return quic_minmax_reset(m, t, meas);  /* forget earlier samples */
+
+	if (unlikely(val.v >= m->s[1].v))
+		m->s[2] = m->s[1] = val;
+	else if (unlikely(val.v >= m->s[2].v))
+		m->s[2] = val;
+
+	return quic_minmax_subwin_update(m, win, &val);
+}
+
+/* Do we estimate that STARTUP filled the pipe? */
+static bool bbr_full_bw_reached(const struct sock *sk)
+{
+	const struct quic_bbr *bbr = quic_ca(sk);
+
+	return bbr->full_bw_cnt >= bbr_full_bw_cnt;
+}
+
+/* Return the windowed max recent bandwidth sample, in pkts/uS << BW_SCALE. */
+static u32 bbr_max_bw(const struct sock *sk)
+{
+	struct quic_bbr *bbr = quic_ca(sk);
+
+	return quic_minmax_get(&bbr->bw);
+}
+
+/* Return the estimated bandwidth of the path, in pkts/uS << BW_SCALE. */
+static u32 bbr_bw(const struct sock *sk)
+{
+	return bbr_max_bw(sk);
+}
+
+/* Length of the packets the model is counted in. */
+static u32 bbr_pkt_len(const struct sock *sk)
+{
+	return quic_sk(sk)->avg_pkt_len ? : QUIC_BBR_PKT_LEN;
+}
+
+/* Bytes of the socket (cwnd, in flight) to packets of the model, rounded up. */
+static u32 bbr_bytes_to_pkts(const struct sock *sk, u32 bytes)
+{
+	return DIV_ROUND_UP(bytes, bbr_pkt_len(sk));
+}
+
+/* Convert a BBR bw and gain factor to a pacing rate in bytes per second. */
+static u64 bbr_rate_bytes_per_sec(struct sock *sk, u64 rate, int gain)
+{
+	rate *= bbr_pkt_len(sk);
+	rate *= gain;
+	rate >>= BBR_SCALE;
+	rate *= USEC_PER_SEC;
+	return rate >> BW_SCALE;
+}
+
+/* Initialize pacing rate to: high_gain * init_cwnd / RTT. */
+static void bbr_init_pacing_rate_from_rtt(struct sock *sk)
+{
+	struct quic_sock *qp = quic_sk(sk);
+	struct quic_bbr *bbr = quic_ca(sk);
+	u64 bw;
+	u32 rtt_us;
+
+	if (!qp->first_rtt) {		/* any RTT sample yet? */
+		rtt_us = max(qp->srtt >> 3, 1U);
+	} else {			 /* no RTT sample yet */
+		rtt_us = USEC_PER_MSEC;	 /* use nominal default RTT */
+	}
+	bw = (u64)bbr_bytes_to_pkts(sk, qp->cwnd) * BW_UNIT;
+	do_div(bw, rtt_us);
+	bbr->pacing_rate = bbr_rate_bytes_per_sec(sk, bw, bbr_high_gain);
+}
+
+/* Pace using current bw estimate and a gain factor. Until the pipe is full the pacing rate
+ * only goes up, as the estimate can only be an underestimate then.
+ */
+static void bbr_set_pacing_rate(struct sock *sk, u32 bw, int gain)
+{
+	struct quic_bbr *bbr = quic_ca(sk);
+	u64 rate = bbr_rate_bytes_per_sec(sk, bw, gain);
+
+	if (bbr_full_bw_reached(sk) || rate > bbr->pacing_rate)
+		bbr->pacing_rate = rate;
+}
+
+/* Save "last known good" cwnd so we can restore it after losses. */
+static void bbr_save_cwnd(struct sock *sk)
+{
+	struct quic_sock *qp = quic_sk(sk);
+	struct quic_bbr *bbr = quic_ca(sk);
+
+	if (bbr->prev_ca_state < QUIC_CA_Recovery && bbr->mode != BBR_PROBE_RTT)
+		bbr->prior_cwnd = bbr_bytes_to_pkts(sk, qp->cwnd);  /* this cwnd is good enough */
+	else  /* loss recovery or BBR_PROBE_RTT have temporarily cut cwnd */
+		bbr->prior_cwnd = max(bbr->prior_cwnd, bbr_bytes_to_pkts(sk, qp->cwnd));
+}
+
+/* Find target cwnd. Right-size the cwnd based on min RTT and the
+ * estimated bottleneck bandwidth:
+ *
+ * cwnd = bw * min_rtt * gain = BDP * gain
+ *
+ * The key factor, gain, controls the amount of queue. While a small gain
+ * builds a smaller queue, it becomes more vulnerable to noise in RTT
+ * measurements (e.g., delayed ACKs or other ACK compression effects). This
+ * noise may cause BBR to under-estimate the rate.
+ *
+ * To achieve full performance in high-speed paths, we budget enough cwnd to
+ * fit full-sized packets in flight on the peer's delayed ACK timer.
+ */
+static u32 bbr_target_cwnd(struct sock *sk, u32 bw, int gain)
+{
+	struct quic_bbr *bbr = quic_ca(sk);
+	u32 cwnd;
+	u64 w;
+
+	/* If we've never had a valid RTT sample, cap cwnd at the initial
+	 * default. This should only happen when every packet ACKed so far was
+	 * ACKed after a retransmission, so no RTT could be sampled.
+	 */
+	if (unlikely(bbr->min_rtt_us == ~0U))	 /* no valid RTT samples yet? */
+		return IW;  /* be safe: cap at default initial cwnd*/
+
+	w = (u64)bw * bbr->min_rtt_us;
+
+	/* Apply a gain to the given value, then remove the BW_SCALE shift. */
+	cwnd = (((w * gain) >> BBR_SCALE) + BW_UNIT - 1) / BW_UNIT;
+
+	/* Allow enough full-sized packets in flight for the receiver's delayed ACKs. */
+	cwnd += 2;
+
+	/* Reduce delayed ACKs by rounding up cwnd to the next even number. */
+	cwnd = (cwnd + 1) & ~1U;
+
+	return cwnd;
+}
+
+/* An optimization in BBR to reduce losses: On the first round of recovery, we
+ * follow the packet conservation principle: send P packets per P packets acked.
+ * After that, we slow-start and send at most 2*P packets per P packets acked.
+ * After recovery finishes, or upon undo, we restore the cwnd we had when
+ * recovery started (capped by the target cwnd based on estimated BDP).
+ */
+static bool bbr_set_cwnd_to_recover_or_restore(
+	struct sock *sk, const struct quic_ack_sample *rs, u32 acked, u32 *new_cwnd)
+{
+	struct quic_sock *qp = quic_sk(sk);
+	struct quic_bbr *bbr = quic_ca(sk);
+	u8 prev_state = bbr->prev_ca_state, state = qp->ca_state;
+	u32 cwnd = bbr_bytes_to_pkts(sk, qp->cwnd);
+
+	/* An ACK for P pkts should release at most 2*P packets. We do this
+	 * in two steps. First, here we deduct the number of lost packets.
+	 * Then, in bbr_set_cwnd() we slow start up toward the target cwnd.
+	 */
+	if (rs->lost > 0)
+		cwnd = max_t(s32, cwnd - rs->lost, 1);
+
+	if (state == QUIC_CA_Recovery && prev_state != QUIC_CA_Recovery) {
+		/* Starting 1st round of Recovery, so do packet conservation. */
+		bbr->packet_conservation = 1;
+		bbr->next_rtt_delivered = qp->delivered;  /* start round now */
+		/* Cut unused cwnd from app behavior or other factors. */
+		cwnd = qp->packets_out + acked;
+	} else if (prev_state >= QUIC_CA_Recovery && state < QUIC_CA_Recovery) {
+		/* Exiting loss recovery; restore cwnd saved before recovery. */
+		bbr->restore_cwnd = 1;
+		bbr->packet_conservation = 0;
+	}
+	bbr->prev_ca_state = state;
+
+	if (bbr->restore_cwnd) {
+		/* Restore cwnd after exiting loss recovery or PROBE_RTT. */
+		cwnd = max(cwnd, bbr->prior_cwnd);
+		bbr->restore_cwnd = 0;
+	}
+
+	if (bbr->packet_conservation) {
+		*new_cwnd = max(cwnd, qp->packets_out + acked);
+		return true;	/* yes, using packet conservation */
+	}
+	*new_cwnd = cwnd;
+	return false;
+}
+
+/* Slow-start up toward target cwnd (if bw estimate is growing, or packet loss
+ * has drawn us down below target), or snap down to target if we're above it.
+ */
+static void bbr_set_cwnd(struct sock *sk, const struct quic_ack_sample *rs,
+			 u32 acked, u32 bw, int gain)
+{
+	struct quic_sock *qp = quic_sk(sk);
+	struct quic_bbr *bbr = quic_ca(sk);
+	u32 cwnd = 0, target_cwnd = 0;
+
+	if (!acked)
+		return;
+
+	if (bbr_set_cwnd_to_recover_or_restore(sk, rs, acked, &cwnd))
+		goto done;
+
+	/* If we're below target cwnd, slow start cwnd toward target cwnd. */
+	target_cwnd = bbr_target_cwnd(sk, bw, gain);
+	if (bbr_full_bw_reached(sk))  /* only cut cwnd if we filled the pipe */
+		cwnd = min(cwnd + acked, target_cwnd);
+	else if (cwnd < target_cwnd || qp->delivered < IW)
+		cwnd = cwnd + acked;
+	cwnd = max(cwnd, bbr_cwnd_min_target);
+
+done:
+	if (bbr->mode == BBR_PROBE_RTT)  /* drain queue, refresh min_rtt */
+		cwnd = min(cwnd, bbr_cwnd_min_target);
+	qp->cwnd = cwnd * bbr_pkt_len(sk);
+}
+
+/* End cycle phase if it's time and/or we hit the phase's in-flight target. */
+static bool bbr_is_next_cycle_phase(struct sock *sk, const struct quic_ack_sample *rs,
+				    u32 prior_in_flight)
+{
+	struct quic_bbr *bbr = quic_ca(sk);
+	bool is_full_length = (s32)(QUIC_TIMESTAMP - bbr->cycle_mstamp) > (s32)bbr->min_rtt_us;
+	u32 bw;
+
+	/* The pacing_gain of 1.0 paces at the estimated bw to try to fully
+	 * use the pipe without increasing the queue.
+	 */
+	if (bbr->pacing_gain == BBR_UNIT)
+		return is_full_length;		/* just use wall clock time */
+
+	bw = bbr_max_bw(sk);
+
+	/* A pacing_gain > 1.0 probes for bw by trying to raise inflight to at
+	 * least pacing_gain*BDP; this may take more than min_rtt if min_rtt is
+	 * small (e.g. on a LAN). We do not persist if packets are lost, since
+	 * a path with small buffers may not hold that much.
+	 */
+	if (bbr->pacing_gain > BBR_UNIT)
+		return is_full_length &&
+			(rs->lost ||  /* perhaps pacing_gain*BDP won't fit */
+			 prior_in_flight >= bbr_target_cwnd(sk, bw, bbr->pacing_gain));
+
+	/* A pacing_gain < 1.0 tries to drain extra queue we added if bw
+	 * probing didn't find more bw. If inflight falls to match BDP then we
+	 * estimate queue is drained; persisting would underutilize the pipe.
+	 */
+	return is_full_length ||
+		prior_in_flight <= bbr_target_cwnd(sk, bw, BBR_UNIT);
+}
+
+static void bbr_advance_cycle_phase(struct sock *sk)
+{
+	struct quic_bbr *bbr = quic_ca(sk);
+
+	bbr->cycle_idx = (bbr->cycle_idx + 1) & (CYCLE_LEN - 1);
+	bbr->cycle_mstamp = QUIC_TIMESTAMP;
+	bbr->pacing_gain = bbr_pacing_gain[bbr->cycle_idx];
+}
+
+/* Gain cycling: cycle pacing gain to converge to fair share of available bw. */
+static void bbr_update_cycle_phase(struct sock *sk, const struct quic_ack_sample *rs,
+				   u32 prior_in_flight)
+{
+	struct quic_bbr *bbr = quic_ca(sk);
+
+	if (bbr->mode == BBR_PROBE_BW &&
+	    bbr_is_next_cycle_phase(sk, rs, prior_in_flight))
+		bbr_advance_cycle_phase(sk);
+}
+
+static void bbr_reset_startup_mode(struct sock *sk)
+{
+	struct quic_bbr *bbr = quic_ca(sk);
+
+	bbr->mode = BBR_STARTUP;
+	bbr->pacing_gain = bbr_high_gain;
+	bbr->cwnd_gain	 = bbr_high_gain;
+}
+
+static void bbr_reset_probe_bw_mode(struct sock *sk)
+{
+	struct quic_bbr *bbr = quic_ca(sk);
+
+	bbr->mode = BBR_PROBE_BW;
+	bbr->pacing_gain = BBR_UNIT;
+	bbr->cwnd_gain = bbr_cwnd_gain;
+	bbr->cycle_idx = CYCLE_LEN - 1 - prandom_u32() % (CYCLE_LEN - 1);
+	bbr_advance_cycle_phase(sk);	/* flip to next phase of gain cycle */
+}
+
+static void bbr_reset_mode(struct sock *sk)
+{
+	if (!bbr_full_bw_reached(sk))
+		bbr_reset_startup_mode(sk);
+	else
+		bbr_reset_probe_bw_mode(sk);
+}
+
+/* Estimate the bandwidth based on how fast packets are delivered */
+static void bbr_update_bw(struct sock *sk, const struct quic_ack_sample *rs)
+{
+	struct quic_sock *qp = quic_sk(sk);
+	struct quic_bbr *bbr = quic_ca(sk);
+	u64 bw;
+
+	bbr->round_start = 0;
+	if (!rs->delivered || rs->interval_us <= 0)
+		return; /* Not a valid observation */
+
+	/* See if we've reached the next RTT */
+	if (!before(rs->prior_delivered, bbr->next_rtt_delivered)) {
+		bbr->next_rtt_delivered = qp->delivered;
+		bbr->rtt_cnt++;
+		bbr->round_start = 1;
+		bbr->packet_conservation = 0;
+	}
+
+	/* Divide delivered by the interval to find a (lower bound) bottleneck
+	 * bandwidth sample. Delivered is in packets and interval_us in uS and
+	 * ratio will be <<1 for most connections. So delivered is first scaled.
+	 */
+	bw = (u64)rs->delivered * BW_UNIT;
+	do_div(bw, rs->interval_us);
+
+	/* If this sample is application-limited, it is likely to have a very
+	 * low delivered count that represents application behavior rather than
+	 * the available network rate. Such a sample could drag down estimated
+	 * bw, causing needless slow-down. Thus, to continue to send at the
+	 * last measured network rate, we filter out app-limited samples unless
+	 * they describe the path bw at least as well as our bw model.
+	 *
+	 * So the goal during app-limited phase is to proceed with the best
+	 * network rate no matter how long. We automatically leave this
+	 * phase when app writes faster than the network can deliver :)
+	 */
+	if (!rs->is_app_limited || bw >= bbr_max_bw(sk)) {
+		/* Incorporate new sample into our max bw filter. */
+		quic_minmax_running_max(&bbr->bw, bbr_bw_rtts, bbr->rtt_cnt, bw);
+	}
+}
+
+/* Estimate when the pipe is full, using the change in delivery rate: BBR
+ * estimates that STARTUP filled the pipe if the estimated bw hasn't changed by
+ * at least bbr_full_bw_thresh (25%) after bbr_full_bw_cnt (3) non-app-limited
+ * rounds. Why 3 rounds: 1: rwin autotuning grows the rwin, 2: we fill the
+ * higher rwin, 3: we get higher delivery rate samples. Or transient
+ * cross-traffic or radio noise can go away. CUBIC Hystart shares a similar
+ * design goal, but uses delay and inter-ACK spacing instead of bandwidth.
+ */
+static void bbr_check_full_bw_reached(struct sock *sk, const struct quic_ack_sample *rs)
+{
+	struct quic_bbr *bbr = quic_ca(sk);
+	u32 bw_thresh;
+
+	if (bbr_full_bw_reached(sk) || !bbr->round_start || rs->is_app_limited)
+		return;
+
+	bw_thresh = (u64)bbr->full_bw * bbr_full_bw_thresh >> BBR_SCALE;
+	if (bbr_max_bw(sk) >= bw_thresh) {
+		bbr->full_bw = bbr_max_bw(sk);
+		bbr->full_bw_cnt = 0;
+		return;
+	}
+	++bbr->full_bw_cnt;
+}
+
+/* If pipe is probably full, drain the queue and then enter steady-state. */
+static void bbr_check_drain(struct sock *sk)
+{
+	struct quic_sock *qp = quic_sk(sk);
+	struct quic_bbr *bbr = quic_ca(sk);
+
+	if (bbr->mode == BBR_STARTUP && bbr_full_bw_reached(sk)) {
+		bbr->mode = BBR_DRAIN;	/* drain queue we created */
+		bbr->pacing_gain = bbr_drain_gain;	/* pace slow to drain */
+		bbr->cwnd_gain = bbr_high_gain;	/* maintain cwnd */
+	}	/* fall through to check if in-flight is already small: */
+	if (bbr->mode == BBR_DRAIN &&
+	    qp->packets_out <= bbr_target_cwnd(sk, bbr_max_bw(sk), BBR_UNIT))
+		bbr_reset_probe_bw_mode(sk);  /* we estimate queue is drained */
+}
+
+/* The goal of PROBE_RTT mode is to have BBR flows cooperatively and
+ * periodically drain the bottleneck queue, to converge to measure the true
+ * min_rtt (unloaded propagation delay). This allows the flows to keep queues
+ * small (reducing queuing delay and packet loss) and achieve fairness among
+ * BBR flows.
+ *
+ * The min_rtt filter window is 10 seconds. When the min_rtt estimate expires,
+ * we enter PROBE_RTT mode and cap the cwnd at bbr_cwnd_min_target=4 packets.
+ * After at least bbr_probe_rtt_mode_us=200ms and at least one packet-timed
+ * round trip elapsed with that flight size <= 4, we leave PROBE_RTT mode and
+ * re-enter the previous mode. BBR uses 200ms to approximately bound the
+ * performance penalty of PROBE_RTT's cwnd capping to roughly 2% (200ms/10s).
+ */
+static void bbr_update_min_rtt(struct sock *sk, const struct quic_ack_sample *rs, s32 rtt)
+{
+	struct quic_sock *qp = quic_sk(sk);
+	struct quic_bbr *bbr = quic_ca(sk);
+	u32 now = QUIC_TIMESTAMP;
+	bool filter_expired;
+
+	/* Track min RTT seen in the min_rtt_win_sec filter window: */
+	filter_expired = after(now, bbr->min_rtt_stamp + bbr_min_rtt_win_us);
+	if (rtt >= 0 &&
+	    (rtt <= bbr->min_rtt_us || filter_expired)) {
+		bbr->min_rtt_us = rtt;
+		bbr->min_rtt_stamp = now;
+	}
+
+	if (bbr_probe_rtt_mode_us > 0 && filter_expired &&
+	    bbr->mode != BBR_PROBE_RTT) {
+		bbr->mode = BBR_PROBE_RTT;  /* dip, drain queue */
+		bbr->pacing_gain = BBR_UNIT;
+		bbr->cwnd_gain = BBR_UNIT;
+		bbr_save_cwnd(sk);  /* note cwnd so we can restore it */
+		bbr->probe_rtt_done_stamp = 0;
+	}
+
+	if (bbr->mode == BBR_PROBE_RTT) {
+		/* Ignore low rate samples during this mode. */
+		qp->app_limited = (qp->delivered + qp->packets_out) ? : 1;
+		/* Maintain min packets in flight for max(200 ms, 1 round). */
+		if (!bbr->probe_rtt_done_stamp &&
+		    qp->packets_out <= bbr_cwnd_min_target) {
+			bbr->probe_rtt_done_stamp = (now + bbr_probe_rtt_mode_us) ? : 1;
+			bbr->probe_rtt_round_done = 0;
+			bbr->next_rtt_delivered = qp->delivered;
+		} else if (bbr->probe_rtt_done_stamp) {
+			if (bbr->round_start)
+				bbr->probe_rtt_round_done = 1;
+			if (bbr->probe_rtt_round_done &&
+			    after(now, bbr->probe_rtt_done_stamp)) {
+				bbr->min_rtt_stamp = now;
+				bbr->restore_cwnd = 1;  /* snap to prior_cwnd */
+				bbr_reset_mode(sk);
+			}
+		}
+	}
+}
+
+static void bbr_update_model(struct sock *sk, const struct quic_ack_sample *rs,
+			     u32 prior_in_flight, s32 rtt)
+{
+	bbr_update_bw(sk, rs);
+	bbr_update_cycle_phase(sk, rs, prior_in_flight);
+	bbr_check_full_bw_reached(sk, rs);
+	bbr_check_drain(sk);
+	bbr_update_min_rtt(sk, rs, rtt);
+}
+
+static void bbr_on_ack(struct sock *sk, const struct quic_ack_sample *rs,
+		       u32 prior_in_flight, s32 rtt)
+{
+	struct quic_bbr *bbr = quic_ca(sk);
+	u32 bw;
+
+	prior_in_flight = bbr_bytes_to_pkts(sk, prior_in_flight);
+	bbr_update_model(sk, rs, prior_in_flight, rtt);
+
+	bw = bbr_bw(sk);
+	bbr_set_pacing_rate(sk, bw, bbr->pacing_gain);
+	bbr_set_cwnd(sk, rs, rs->acked, bw, bbr->cwnd_gain);
+}
+
+static void bbr_init(struct sock *sk)
+{
+	struct quic_sock *qp = quic_sk(sk);
+	struct quic_bbr *bbr = quic_ca(sk);
+
+	bbr->prior_cwnd = 0;
+	qp->ssthresh = UINT_MAX;	/* BBR does not use ssthresh */
+	bbr->rtt_cnt = 0;
+	bbr->next_rtt_delivered = 0;
+	bbr->prev_ca_state = QUIC_CA_Open;
+	bbr->packet_conservation = 0;
+
+	bbr->probe_rtt_done_stamp = 0;
+	bbr->probe_rtt_round_done = 0;
+	bbr->min_rtt_us = qp->min_rtt;
+	bbr->min_rtt_stamp = QUIC_TIMESTAMP;
+
+	quic_minmax_reset(&bbr->bw, bbr->rtt_cnt, 0);  /* init max bw to 0 */
+
+	bbr_init_pacing_rate_from_rtt(sk);
+
+	bbr->restore_cwnd = 0;
+	bbr->round_start = 0;
+	bbr->full_bw = 0;
+	bbr->full_bw_cnt = 0;
+	bbr->cycle_mstamp = QUIC_TIMESTAMP;
+	bbr->cycle_idx = 0;
+	bbr_reset_startup_mode(sk);
+}
+
+/* Start of a recovery period: the model is not touched by losses, only the cwnd is noted so
+ * it can be restored after recovery. cwnd itself goes to packet conservation on the next ACK.
+ */
+static void bbr_on_loss(struct sock *sk, const struct quic_ack_sample *rs)
+{
+	bbr_save_cwnd(sk);
+}
+
+/* Persistent congestion: quic.c already collapsed cwnd, look for the full bw again. */
+static void bbr_on_rto(struct sock *sk)
+{
+	struct quic_bbr *bbr = quic_ca(sk);
+
+	bbr->prev_ca_state = QUIC_CA_Loss;
+	bbr->full_bw = 0;
+	bbr->round_start = 1;	/* treat RTO like end of a round */
+}
+
+/* The losses were spurious: keep cwnd, but look for the full bw again. */
+static u32 bbr_undo_cwnd(struct sock *sk)
+{
+	struct quic_bbr *bbr = quic_ca(sk);
+
+	bbr->full_bw = 0;   /* spurious slow-down; reset full pipe detection */
+	bbr->full_bw_cnt = 0;
+	return quic_sk(sk)->cwnd;
+}
+
+static u64 bbr_pacing_rate(struct sock *sk)
+{
+	struct quic_bbr *bbr = quic_ca(sk);
+
+	return bbr->pacing_rate;
+}
+
+static struct quic_congestion_ops quic_bbr_cong_ops __read_mostly = {
+	.init		= bbr_init,
+	.on_ack		= bbr_on_ack,
+	.on_loss	= bbr_on_loss,
+	.on_rto		= bbr_on_rto,
+	.undo		= bbr_undo_cwnd,
+	.pacing_rate	= bbr_pacing_rate,
+	.owner		= THIS_MODULE,
+	.name		= "bbr",
+};
+
+static int __init quic_bbr_register(void)
+{
+	BUILD_BUG_ON(sizeof(struct quic_bbr) > QUIC_CA_PRIV_SIZE);
+	return quic_register_congestion_control(&quic_bbr_cong_ops);
+}
+
+static void __exit quic_bbr_unregister(void)
+{
+	quic_unregister_congestion_control(&quic_bbr_cong_ops);
+}
+
+module_init(quic_bbr_register);
+module_exit(quic_bbr_unregister);
+
+MODULE_LICENSE("Dual BSD/GPL");
+MODULE_DESCRIPTION("BBR congestion control for QUIC");
+MODULE_ALIAS("quic-cong-bbr");